@@ -4,8 +4,32 @@
 #include "modelLoader.h"
 #include "tgaimage.h"
 
-// ȫ־ڱ任㵽Ļ
-mat<4, 4> ModelView, Viewport, Perspective;
+// Ⱦ״̬ڱ任㵽ĻԼϾ Perspective * ModelView
+// ֻͨ lookat / perspective / viewport ޸ģ޸ĺһζȡ mvp() ʱˣ֮һֱ
+class RenderState {
+public:
+    const mat<4, 4>& modelview() const { return ModelView; }
+    const mat<4, 4>& perspective() const { return Perspective; }
+    const mat<4, 4>& viewport() const { return Viewport; }
+    const mat<4, 4>& mvp() const {
+        if (!fresh) {
+            MVP = Perspective * ModelView;
+            fresh = true;
+        }
+        return MVP;
+    }
+
+    void set_modelview(const mat<4, 4>& m) { ModelView = m; fresh = false; }
+    void set_perspective(const mat<4, 4>& m) { Perspective = m; fresh = false; }
+    void set_viewport(const mat<4, 4>& m) { Viewport = m; fresh = false; }
+
+private:
+    mat<4, 4> ModelView, Perspective, Viewport;
+    mutable mat<4, 4> MVP;
+    mutable bool fresh = false; // MVP Ƿһ
+};
+
+RenderState render_state;
 
 // ͼ gluLookAt
 void lookat(const vec3 eye, const vec3 center, const vec3 up) {
@@ -14,7 +38,7 @@ void lookat(const vec3 eye, const vec3 center, const vec3 up) {
     vec3 m = normalized(cross(n, l));           // Ϸy ᣩ
 
     // ת󣨽ת꣩
-    ModelView = mat<4, 4>{
+    render_state.set_modelview(mat<4, 4>{
         {{l.x,l.y,l.z,0},
          {m.x,m.y,m.z,0},
          {n.x,n.y,n.z,0},
@@ -26,29 +50,29 @@ void lookat(const vec3 eye, const vec3 center, const vec3 up) {
                 { 0,1,0,-center.y },
                 { 0,0,1,-center.z },
                 { 0,0,0,1 }}
-    };
+    });
 }
 
 // ͸ͶӰ
 void perspective(const double f) {
     // ͸Ӿf Ϊ
-    Perspective = {
+    render_state.set_perspective({
         {{1,0,0,0},
          {0,1,0,0},
          {0,0,1,0},
          {0,0,-1 / f,1}}
-    };
+    });
 }
 
 // Ļӿڱ任
 void viewport(const int x, const int y, const int w, const int h) {
     // һ豸꣨[-1,1]ӳ䵽Ļ
-    Viewport = {
+    render_state.set_viewport({
         {{w / 2., 0, 0, x + w / 2.},
          {0, h / 2., 0, y + h / 2.},
          {0, 0, 1, 0},
          {0, 0, 0, 1}}
-    };
+    });
 }
 
 // դΣclip-space  -> Ļأ
@@ -58,9 +82,9 @@ void rasterize(const vec4 clip[3], std::vector<double>& zbuffer, TGAImage& frame
 
     // NDC -> Ļ
     vec2 screen[3] = {
-        (Viewport * ndc[0]).xy(),
-        (Viewport * ndc[1]).xy(),
-        (Viewport * ndc[2]).xy()
+        (render_state.viewport() * ndc[0]).xy(),
+        (render_state.viewport() * ndc[1]).xy(),
+        (render_state.viewport() * ndc[2]).xy()
     };
 
     //  ABCڼ
@@ -133,7 +157,7 @@ int main(int argc, char** argv) {
             // ε clip-space 
             for (int d : {0, 1, 2}) {
                 vec3 v = model.vert(i, d);
-                clip[d] = Perspective * ModelView * vec4{ v.x, v.y, v.z, 1. };
+                clip[d] = render_state.mvp() * vec4{ v.x, v.y, v.z, 1. };
             }
 
             // ɫ
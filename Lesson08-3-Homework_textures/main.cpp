@@ -2,7 +2,6 @@
 #include "modelLoader.h"
 #include <algorithm>
 
-extern mat<4, 4> ModelView, Perspective; // "OpenGL" ״̬
 extern std::vector<double> zbuffer;     // Ȼ
 
 struct SimpleShader : IShader {
@@ -15,18 +14,18 @@ struct SimpleShader : IShader {
 
     SimpleShader(const Model& m, const vec3& light_world) : model(m) {
         // Դ任ۿռ
-        light_dir = normalized((ModelView * vec4(light_world.x, light_world.y, light_world.z, 0.0)).xyz());
+        light_dir = normalized((render_state.modelview() * vec4(light_world.x, light_world.y, light_world.z, 0.0)).xyz());
     }
 
     virtual vec4 vertex(const int face, const int vert) {
-        vec4 v_eye = ModelView * model.vert(face, vert);
+        vec4 v_eye = render_state.modelview() * model.vert(face, vert);
         tri[vert] = v_eye.xyz();
 
         // ߱任ۿռ
-        nrm[vert] = normalized((ModelView.invert_transpose() * model.normal(face, vert)).xyz());
+        nrm[vert] = normalized((render_state.normal_matrix() * model.normal(face, vert)).xyz());
 
         uv[vert] = model.uv(face, vert);
-        return Perspective * v_eye;
+        return render_state.perspective() * v_eye;
     }
 
     virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const {
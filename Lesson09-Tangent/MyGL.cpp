@@ -1,32 +1,40 @@
 #include <algorithm>
 #include "MyGL.h"
 
-mat<4, 4> ModelView, Viewport, Perspective; // ȫ־ģͼӿڡ͸
+RenderState render_state;                  // ȫȾ״̬ģͼ͸ӡӿھ
 std::vector<double> zbuffer;               // ȫ Z-bufferȲ
 
+// ------------------- Ⱦ״̬ -------------------
+void RenderState::update() const {
+    if (fresh) return;
+    NormalMatrix = ModelView.invert_transpose();
+    MVP = Perspective * ModelView;
+    fresh = true;
+}
+
 // -------------------  -------------------
 void lookat(const vec3 eye, const vec3 center, const vec3 up) {
     vec3 n = normalized(eye - center);          // ߷
     vec3 l = normalized(cross(up, n));          // ҷ
     vec3 m = normalized(cross(n, l));           // Ϸ
     //  ModelView ת * ƽ
-    ModelView = mat<4, 4>{ {{l.x,l.y,l.z,0}, {m.x,m.y,m.z,0}, {n.x,n.y,n.z,0}, {0,0,0,1}} } *
-        mat<4, 4>{{{1, 0, 0, -center.x}, { 0,1,0,-center.y }, { 0,0,1,-center.z }, { 0,0,0,1 }}};
+    render_state.set_modelview(mat<4, 4>{ {{l.x,l.y,l.z,0}, {m.x,m.y,m.z,0}, {n.x,n.y,n.z,0}, {0,0,0,1}} } *
+        mat<4, 4>{{{1, 0, 0, -center.x}, { 0,1,0,-center.y }, { 0,0,1,-center.z }, { 0,0,0,1 }}});
 }
 
 // ------------------- ͸ͶӰ -------------------
 void init_perspective(const double f) {
     // ͸Ӿ󣬽 z ӳ䵽 [-1,1] Χ
-    Perspective = { {{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,-1 / f,1}} };
+    render_state.set_perspective({ {{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,-1 / f,1}} });
 }
 
 // ------------------- ӿھ -------------------
 void init_viewport(const int x, const int y, const int w, const int h) {
     // ׼豸꣨[-1,1]ӳ䵽Ļ
-    Viewport = { {{w / 2., 0, 0, x + w / 2.},
-                  {0, h / 2., 0, y + h / 2.},
-                  {0,0,1,0},
-                  {0,0,0,1}} };
+    render_state.set_viewport({ {{w / 2., 0, 0, x + w / 2.},
+                                 {0, h / 2., 0, y + h / 2.},
+                                 {0,0,1,0},
+                                 {0,0,0,1}} });
 }
 
 // ------------------- Z-buffer ʼ -------------------
@@ -40,7 +48,7 @@ void rasterize(const Triangle& clip, const IShader& shader, TGAImage& framebuffe
     // ζӲüռһ NDC ռ
     vec4 ndc[3] = { clip[0] / clip[0].w, clip[1] / clip[1].w, clip[2] / clip[2].w };
     //  NDC ӳ䵽Ļ
-    vec2 screen[3] = { (Viewport * ndc[0]).xy(), (Viewport * ndc[1]).xy(), (Viewport * ndc[2]).xy() };
+    vec2 screen[3] = { (render_state.viewport() * ndc[0]).xy(), (render_state.viewport() * ndc[1]).xy(), (render_state.viewport() * ndc[2]).xy() };
 
     //  3x3  ABC
     mat<3, 3> ABC = { { {screen[0].x, screen[0].y, 1.},
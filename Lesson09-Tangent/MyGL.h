@@ -1,6 +1,31 @@
 #include "tgaimage.h" 
 #include "geometry.h"   
 
+// Ⱦ״̬ModelViewPerspectiveViewport Լľ
+// ֻͨ lookat / init_perspective / init_viewport ޸ģ޸ʱʧЧ
+// ʧЧһζȡʱ¼㣬֮һֱãɫÿȡ normal_matrix() ظ
+class RenderState {
+public:
+    const mat<4, 4>& modelview() const { return ModelView; }
+    const mat<4, 4>& perspective() const { return Perspective; }
+    const mat<4, 4>& viewport() const { return Viewport; }
+    const mat<4, 4>& normal_matrix() const { update(); return NormalMatrix; } // ModelView תãڱ任
+    const mat<4, 4>& mvp() const { update(); return MVP; }                    // Perspective * ModelView
+
+    void set_modelview(const mat<4, 4>& m) { ModelView = m; fresh = false; }
+    void set_perspective(const mat<4, 4>& m) { Perspective = m; fresh = false; }
+    void set_viewport(const mat<4, 4>& m) { Viewport = m; fresh = false; }
+
+private:
+    void update() const; // ʧЧʱ¼
+
+    mat<4, 4> ModelView, Perspective, Viewport;
+    mutable mat<4, 4> NormalMatrix, MVP;
+    mutable bool fresh = false; // Ƿһ
+};
+
+extern RenderState render_state; // ȫȾ״̬
+
 // ӽǵĺ
 void lookat(const vec3 eye, const vec3 center, const vec3 up);
 
@@ -18,6 +43,8 @@ struct IShader {
     static TGAColor sample2D(const TGAImage& img, const vec2& uvf) {
         return img.get(uvf[0] * img.width(), uvf[1] * img.height());
     }
+    // ͼԪ vertex() ֮󡢹դ֮ǰһΣԤֻйص
+    virtual void setup() {}
     virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const = 0;
 };
 
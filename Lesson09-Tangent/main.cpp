@@ -2,7 +2,6 @@
 #include "modelLoader.h"
 #include <algorithm>
 
-extern mat<4, 4> ModelView, Perspective; // "OpenGL" ״̬
 extern std::vector<double> zbuffer;     // ӽȻ
 
 struct TangentShader : IShader {
@@ -11,19 +10,29 @@ struct TangentShader : IShader {
     vec4 varying_nrm[3];   // 㷨ߣeye space, vec4
     vec2 varying_uv[3];    //  UV
     vec4 l;                // Դeye space
+    vec4 tangent, bitangent; // ǰε븱ߣeye space setup() 
 
     TangentShader(const Model& m, const vec3& light) : model(m) {
         // Դת eye space
-        l = normalized(ModelView * vec4{ light.x, light.y, light.z, 0.0 });
+        l = normalized(render_state.modelview() * vec4{ light.x, light.y, light.z, 0.0 });
     }
 
     // ɫ
     virtual vec4 vertex(const int face, const int vert) {
         varying_uv[vert] = model.uv(face, vert);
-        varying_nrm[vert] = ModelView.invert_transpose() * model.normal(face, vert); // ߱任
-        vec4 v_eye = ModelView * model.vert(face, vert);
+        varying_nrm[vert] = render_state.normal_matrix() * model.normal(face, vert); // ߱任
+        vec4 v_eye = render_state.modelview() * model.vert(face, vert);
         tri[vert] = v_eye;
-        return Perspective * v_eye; //  clip space
+        return render_state.perspective() * v_eye; //  clip space
+    }
+
+    // ͼԪ߿ռֻйأÿһ
+    virtual void setup() {
+        mat<2, 4> E = { tri[1] - tri[0], tri[2] - tri[0] };
+        mat<2, 2> U = { varying_uv[1] - varying_uv[0], varying_uv[2] - varying_uv[0] };
+        mat<2, 4> T = U.invert() * E;
+        tangent = normalized(T[0]);
+        bitangent = normalized(T[1]);
     }
 
     // Ƭɫ
@@ -32,12 +41,9 @@ struct TangentShader : IShader {
         vec2 uv = varying_uv[0] * bar[0] + varying_uv[1] * bar[1] + varying_uv[2] * bar[2];
 
         // ߿ռ TBN
-        mat<2, 4> E = { tri[1] - tri[0], tri[2] - tri[0] };
-        mat<2, 2> U = { varying_uv[1] - varying_uv[0], varying_uv[2] - varying_uv[0] };
-        mat<2, 4> T = U.invert() * E;
         mat<4, 4> D = {
-            normalized(T[0]), // 
-            normalized(T[1]), // 
+            tangent,   // 
+            bitangent, // 
             normalized(varying_nrm[0] * bar[0] + varying_nrm[1] * bar[1] + varying_nrm[2] * bar[2]), // ֵ
             {0,0,0,1}
         };
@@ -104,6 +110,7 @@ int main(int argc, char** argv) {
                 shader.vertex(f, 1),
                 shader.vertex(f, 2)
             };
+            shader.setup();
             rasterize(clip, shader, framebuffer);
         }
     }
@@ -1,80 +1,430 @@
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
 #include "MyGL.h"
+#include "modelLoader.h"
 
-mat<4, 4> ModelView, Viewport, Perspective; // ȫ־ģͼӿڡ͸
-std::vector<double> zbuffer;               // ȫ Z-bufferȲ
+using namespace detail;
+
+RenderState render_state;                  // ȫȾ״̬ģͼ͸ӡӿھ
+std::vector<double> zbuffer;               // ȫ Z-bufferȲԣFloat64 ʽ
+
+DepthFormat detail::depth_format = DepthFormat::Float64;
+std::vector<float> detail::zbuffer32;
+std::vector<std::uint32_t> detail::zbuffer24;
+
+constexpr double GUARD_BAND = 8.;            // x/y ı |x|, |y| <= 8w֮Ĳֲõ
+
+std::vector<double> detail::hiz;
+int detail::hiz_width = 0;
+
+#if defined(MYGL_SIMD_AVX) || defined(MYGL_SIMD_SSE2)
+RasterPath detail::raster_path = RasterPath::SIMD;   // SIMD ǲΪĬʵ
+#else
+RasterPath detail::raster_path = RasterPath::Scalar; // û SIMD ָʱֻ߱·
+#endif
+RasterMode detail::raster_mode = RasterMode::Normal;
+
+std::vector<std::uint64_t> detail::visbuffer;
+std::uint64_t detail::vis_draw = 0;
+std::vector<VisibilityDraw> detail::vis_draws;
+
+static PipelineStats last_draw_stats; // һ rasterize ļ
+static PipelineStats frame_counters;  // ֡ۼƵļinit_zbuffer ʱ
+
+// ------------------- Ⱦ״̬ -------------------
+const mat<4, 4>& RenderState::normal_matrix() const {
+    update();
+    return NormalMatrix;
+}
+
+const mat<4, 4>& RenderState::mvp() const {
+    update();
+    return MVP;
+}
+
+void RenderState::set_modelview(const mat<4, 4>& m) {
+    ModelView = m;
+    fresh = false;
+}
+
+void RenderState::set_perspective(const mat<4, 4>& m) {
+    Perspective = m;
+    fresh = false;
+}
+
+void RenderState::set_viewport(const mat<4, 4>& m) {
+    Viewport = m;
+    fresh = false;
+}
+
+void RenderState::update() const {
+    if (fresh.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(update_mutex);
+    if (fresh.load(std::memory_order_relaxed)) return; // ڼ߳
+    NormalMatrix = ModelView.invert_transpose();
+    MVP = Perspective * ModelView;
+    fresh.store(true, std::memory_order_release);
+}
 
 // -------------------  -------------------
 void lookat(const vec3 eye, const vec3 center, const vec3 up) {
-    vec3 n = normalized(eye - center);          // ߷
-    vec3 l = normalized(cross(up, n));          // ҷ
-    vec3 m = normalized(cross(n, l));           // Ϸ
-    //  ModelView ת * ƽ
-    ModelView = mat<4, 4>{ {{l.x,l.y,l.z,0}, {m.x,m.y,m.z,0}, {n.x,n.y,n.z,0}, {0,0,0,1}} } *
-        mat<4, 4>{{{1, 0, 0, -center.x}, { 0,1,0,-center.y }, { 0,0,1,-center.z }, { 0,0,0,1 }}};
+    render_state.set_modelview(lookat_matrix(eye, center, up));
 }
 
 // ------------------- ͸ͶӰ -------------------
 void init_perspective(const double f) {
-    // ͸Ӿ󣬽 z ӳ䵽 [-1,1] Χ
-    Perspective = { {{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,-1 / f,1}} };
+    render_state.set_perspective(perspective_matrix(f));
 }
 
 // ------------------- ӿھ -------------------
 void init_viewport(const int x, const int y, const int w, const int h) {
-    // ׼豸꣨[-1,1]ӳ䵽Ļ
-    Viewport = { {{w / 2., 0, 0, x + w / 2.},
-                  {0, h / 2., 0, y + h / 2.},
-                  {0,0,1,0},
-                  {0,0,0,1}} };
+    render_state.set_viewport(viewport_matrix(x, y, w, h));
+}
+
+// ------------------- ٹѧ -------------------
+SpecularTable::SpecularTable(const double exponent, const int size) : size(size), table(size + 1) {
+    for (int i = 0; i <= size; i++)
+        table[i] = static_cast<float>(std::pow(static_cast<double>(i) / size, exponent));
 }
 
 // ------------------- Z-buffer ʼ -------------------
-void init_zbuffer(const int width, const int height) {
-    // ʼΪһСֵʾԶ
-    zbuffer = std::vector(width * height, -1000.);
+void init_zbuffer(const int width, const int height, const DepthFormat format) {
+    depth_format = format;
+    // ʼΪһСֵʾԶȣֻΪѡеĸʽ洢
+    const double clear = depth_key(-1000.);
+    zbuffer   = format == DepthFormat::Float64 ? std::vector(width * height, clear) : std::vector<double>{};
+    zbuffer32 = format == DepthFormat::Float32 ? std::vector(width * height, static_cast<float>(clear)) : std::vector<float>{};
+    zbuffer24 = format == DepthFormat::Fixed24 ? std::vector(width * height, static_cast<std::uint32_t>(clear)) : std::vector<std::uint32_t>{};
+    hiz_width = (width + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    hiz = std::vector(hiz_width * ((height + HIZ_BLOCK - 1) / HIZ_BLOCK), clear);
+    visbuffer.clear(); // ɼԻȻһϣõʱٷ
+    last_draw_stats = frame_counters = {};
 }
 
-// ------------------- դ -------------------
-void rasterize(const Triangle& clip, const IShader& shader, TGAImage& framebuffer) {
+// ------------------- ν -------------------
+// ÿֻһεĹ͸ӳӿڱ任޳Χ
+static bool setup_triangle(const Triangle& clip, const int face, const int width, const int height, const IShader& shader,
+                           PipelineStats& stats, TriangleSetup& tri, const mat<3, 3>* bar = nullptr) {
     // ζӲüռһ NDC ռ
     vec4 ndc[3] = { clip[0] / clip[0].w, clip[1] / clip[1].w, clip[2] / clip[2].w };
     //  NDC ӳ䵽Ļ
-    vec2 screen[3] = { (Viewport * ndc[0]).xy(), (Viewport * ndc[1]).xy(), (Viewport * ndc[2]).xy() };
+    vec2 screen[3] = { (render_state.viewport() * ndc[0]).xy(), (render_state.viewport() * ndc[1]).xy(), (render_state.viewport() * ndc[2]).xy() };
 
-    //  3x3  ABC
+    //  3x3  ABC
     mat<3, 3> ABC = { { {screen[0].x, screen[0].y, 1.},
                         {screen[1].x, screen[1].y, 1.},
                         {screen[2].x, screen[2].y, 1.} } };
-    if (ABC.det() < 1) return; // ޳ + Сһص
+    if (ABC.det() < 1) { // ޳ + Сһص
+        stats.culled++;
+        return false;
+    }
 
-    // εı߽
+    // εı߽򣬲üĻΧ
     auto [bbminx, bbmaxx] = std::minmax({ screen[0].x, screen[1].x, screen[2].x });
     auto [bbminy, bbmaxy] = std::minmax({ screen[0].y, screen[1].y, screen[2].y });
+    tri.bbminx = std::max<int>(bbminx, 0);
+    tri.bbmaxx = std::min<int>(bbmaxx, width - 1);
+    tri.bbminy = std::max<int>(bbminy, 0);
+    tri.bbmaxy = std::min<int>(bbmaxy, height - 1);
+    if (tri.bbminx > tri.bbmaxx || tri.bbminy > tri.bbmaxy) return false; // ȫĻ
+
+    // ߺֻһ棺ABC^{-T} ĵ i оǵ i  (x, y, 1) ϵ
+    mat<3, 3> edge = ABC.invert_transpose();
+    tri.bc_dx = { edge[0].x, edge[1].x, edge[2].x };
+    tri.bc_dy = { edge[0].y, edge[1].y, edge[2].y };
+    tri.bc_0  = { edge[0].z, edge[1].z, edge[2].z };
+
+    // ĻռԣͬΪƽ淽
+    vec3 z = { ndc[0].z, ndc[1].z, ndc[2].z };
+    tri.z_dx = tri.bc_dx * z;
+    tri.z_dy = tri.bc_dy * z;
+    tri.z_0  = tri.bc_0 * z;
+
+    tri.face = face;
+    for (int i : {0, 1, 2}) {
+        tri.invw[i] = 1. / clip[i].w;
+        tri.varyings[i] = shader.vertex_varyings(face, i);
+    }
+    tri.clipped = bar != nullptr;
+    if (bar) tri.bar = *bar;
+    return true;
+}
+
+// ------------------- βü -------------------
+// ζ㣺üռλãԼԭε꣨üռԣ
+struct ClipVertex {
+    vec4 p;
+    vec3 bar;
+};
+
+// ƽ dist(v) >= 0 ü͹ΣSutherland-Hodgman
+template<typename Dist> static std::vector<ClipVertex> clip_polygon(const std::vector<ClipVertex>& poly, Dist dist) {
+    std::vector<ClipVertex> out;
+    for (int i = 0; i < static_cast<int>(poly.size()); i++) {
+        const ClipVertex& a = poly[i];
+        const ClipVertex& b = poly[(i + 1) % poly.size()];
+        const double da = dist(a.p), db = dist(b.p);
+        if (da >= 0) out.push_back(a);
+        if ((da >= 0) != (db >= 0)) { // ߴƽ棬뽻
+            const double t = da / (da - db);
+            out.push_back({ a.p + (b.p - a.p) * t, a.bar + (b.bar - a.bar) * t });
+        }
+    }
+    return out;
+}
+
+void detail::clip_and_setup(const Triangle& clip, const int face, const int width, const int height, const IShader& shader,
+                            std::vector<TriangleSetup>& tris, PipelineStats& stats) {
+    const auto near_dist = [](const vec4& p) { return p.w - NEAR_W; };
+    const auto inside = [](const vec4& p) {
+        return p.w >= NEAR_W && std::abs(p.x) <= GUARD_BAND * p.w && std::abs(p.y) <= GUARD_BAND * p.w;
+    };
+
+    TriangleSetup tri;
+    if (inside(clip[0]) && inside(clip[1]) && inside(clip[2])) { // ü
+        if (setup_triangle(clip, face, width, height, shader, stats, tri)) tris.push_back(tri);
+        return;
+    }
+    stats.clipped++;
+    if (near_dist(clip[0]) < 0 && near_dist(clip[1]) < 0 && near_dist(clip[2]) < 0) return;
+
+    // Ȳýƽ棬ٲñĸƽ
+    std::vector<ClipVertex> poly = { { clip[0], {1, 0, 0} }, { clip[1], {0, 1, 0} }, { clip[2], {0, 0, 1} } };
+    poly = clip_polygon(poly, near_dist);
+    poly = clip_polygon(poly, [](const vec4& p) { return GUARD_BAND * p.w - p.x; });
+    poly = clip_polygon(poly, [](const vec4& p) { return GUARD_BAND * p.w + p.x; });
+    poly = clip_polygon(poly, [](const vec4& p) { return GUARD_BAND * p.w - p.y; });
+    poly = clip_polygon(poly, [](const vec4& p) { return GUARD_BAND * p.w + p.y; });
+
+    // ǻμ¶ԭ꣬ɫʱԭ
+    for (int i = 1; i + 1 < static_cast<int>(poly.size()); i++) {
+        const Triangle sub = { poly[0].p, poly[i].p, poly[i + 1].p };
+        const mat<3, 3> bar = { { poly[0].bar, poly[i].bar, poly[i + 1].bar } };
+        if (setup_triangle(sub, face, width, height, shader, stats, tri, &bar)) tris.push_back(tri);
+    }
+}
+
+// ------------------- ͳ -------------------
+PipelineStats& PipelineStats::operator+=(const PipelineStats& other) {
+    triangles += other.triangles;
+    culled += other.culled;
+    clipped += other.clipped;
+    hiz_rejected += other.hiz_rejected;
+    bbox_pixels += other.bbox_pixels;
+    covered += other.covered;
+    depth_failed += other.depth_failed;
+    shaded += other.shaded;
+    discarded += other.discarded;
+    writes += other.writes;
+    return *this;
+}
+
+void detail::record_draw_stats(const PipelineStats& stats) {
+    last_draw_stats = stats;
+    frame_counters += stats;
+}
+
+PipelineStats draw_stats() {
+    return last_draw_stats;
+}
+
+PipelineStats frame_stats() {
+    return frame_counters;
+}
+
+// ------------------- դ·ѡ -------------------
+void set_raster_path(const RasterPath path) {
+#if defined(MYGL_SIMD_AVX) || defined(MYGL_SIMD_SSE2)
+    raster_path = path;
+#else
+    (void)path; // δ SIMD ںˣֱ·
+#endif
+}
 
-    // ߽
+RasterPath get_raster_path() {
+    return raster_path;
+}
+
+// ------------------- ԤȾģʽ -------------------
+void set_raster_mode(const RasterMode mode) {
+    raster_mode = mode;
+}
+
+// ------------------- դ -------------------
+// ӿڣͬһģ룬ƬԪɫ麯
+long long rasterize(const std::vector<Triangle>& clip, const IShader& shader, TGAImage& framebuffer) {
+    return rasterize<IShader>(clip, shader, framebuffer);
+}
+
+// 麯ʱĬƬԪɫֻ IShader ʵĹդߵ
+int IShader::fragment_packet(const FragmentPacket& packet, TGAColor color[FragmentPacket::LANES]) const {
+    return detail::fragment_lanes(*this, packet, color);
+}
+
+// ------------------- ʽ varying -------------------
+// ƬԪդջϵ varying 鶼 MAX_VARYINGS 䣬ͻԽд
+int IShader::declare_varying(const int n) {
+    if (nvaryings + n > MAX_VARYINGS) {
+        std::cerr << "Error: " << nvaryings + n << " varying components declared, at most " << MAX_VARYINGS << " are supported" << std::endl;
+        std::abort();
+    }
+    nvaryings += n;
+    return nvaryings - n;
+}
+
+void IShader::allocate_varyings(const Model& model) {
+    varying_model = &model;
+    varying_data.assign(model.ncorners() * nvaryings, 0.);
+}
+
+const real* IShader::vertex_varyings(const int face, const int vert) const {
+    if (!varying_model) return nullptr; // ûеǼ varying
+    return varying_data.data() + varying_model->corner(face, vert) * nvaryings;
+}
+
+// ------------------- ׶ -------------------
+static VertexDedupStats vertex_dedup;
+
+std::vector<Triangle> vertex_stage(const Model& model, IShader& shader) {
+    shader.prepare(model);
+
+    // ȥأÿΨһֻһ vertex()һγֵλϵ
+    std::vector<vec4> transformed(model.ncorners());
+#pragma omp parallel for
+    for (int c = 0; c < model.ncorners(); c++) {
+        const int source = model.corner_source(c);
+        transformed[c] = shader.vertex(source / 3, source % 3);
+    }
+
+    // ΰΨһȡñ任ͼԪ
+    std::vector<Triangle> clip(model.nfaces());
 #pragma omp parallel for
-    for (int x = std::max<int>(bbminx, 0); x <= std::min<int>(bbmaxx, framebuffer.width() - 1); x++) {
-        for (int y = std::max<int>(bbminy, 0); y <= std::min<int>(bbmaxy, framebuffer.height() - 1); y++) {
-            // Ļ
-            vec3 bc_screen = ABC.invert_transpose() * vec3 { static_cast<double>(x), static_cast<double>(y), 1. };
-            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue; // 
-
-            // ͸Ļ굽üռ
-            vec3 bc_clip = { bc_screen.x / clip[0].w, bc_screen.y / clip[1].w, bc_screen.z / clip[2].w };
-            bc_clip = bc_clip / (bc_clip.x + bc_clip.y + bc_clip.z); // һ
-
-            // ֵֵԲֵ NDC.z
-            double z = bc_screen * vec3{ ndc[0].z, ndc[1].z, ndc[2].z };
-            if (z <= zbuffer[x + y * framebuffer.width()]) continue; // Ȳ
-
-            // ƬԪɫȡɫ
-            auto [discard, color] = shader.fragment(bc_clip);
-            if (discard) continue; // ɫ
-
-            //  Z-buffer ֡
-            zbuffer[x + y * framebuffer.width()] = z;
-            framebuffer.set(x, y, color);
+    for (int f = 0; f < model.nfaces(); f++) {
+        clip[f] = { transformed[model.corner(f, 0)], transformed[model.corner(f, 1)], transformed[model.corner(f, 2)] };
+        shader.setup(f);
+    }
+
+    vertex_dedup.corners += 3LL * model.nfaces();
+    vertex_dedup.vertex_calls += model.ncorners();
+    return clip;
+}
+
+VertexDedupStats vertex_dedup_stats() {
+    return vertex_dedup;
+}
+
+// -------------------  -------------------
+long long draw(const Model& model, IShader& shader, TGAImage& framebuffer) {
+    return rasterize(vertex_stage(model, shader), shader, framebuffer);
+}
+
+// ------------------- ɼԻ -------------------
+long long resolve_visibility(TGAImage& framebuffer) {
+    const int width = framebuffer.width(), height = framebuffer.height();
+    const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    long long shaded = 0, discarded = 0;
+
+    if (!visbuffer.empty()) {
+#pragma omp parallel for schedule(dynamic) reduction(+:shaded, discarded)
+        for (int tile = 0; tile < tiles_x * tiles_y; tile++) {
+            const int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+            const int x1 = std::min(x0 + TILE_SIZE, width) - 1, y1 = std::min(y0 + TILE_SIZE, height) - 1;
+
+            bind_tile_lights(tile);
+
+            // ռڵĿɼزͬһεɫvarying ڻ
+            std::vector<std::pair<std::uint64_t, int>> pixels;
+            for (int y = y0; y <= y1; y++)
+                for (int x = x0; x <= x1; x++)
+                    if (visbuffer[x + y * width] != VIS_EMPTY)
+                        pixels.push_back({ visbuffer[x + y * width], x + y * width });
+            std::sort(pixels.begin(), pixels.end());
+
+            for (auto [id, idx] : pixels) {
+                const VisibilityDraw& draw = vis_draws[id >> VIS_TRIANGLE_BITS];
+                const TriangleSetup& tri = draw.tris[id & ((1ull << VIS_TRIANGLE_BITS) - 1)];
+                const int x = idx % width, y = idx / width;
+
+                // ɱߺֱؽص
+                const vec3 bc_screen = tri.bc_dx * x + tri.bc_dy * y + tri.bc_0;
+                const vec3 bar = perspective_bc(tri, bc_screen);
+                double varying[MAX_VARYINGS], ddx[MAX_VARYINGS], ddy[MAX_VARYINGS];
+                interpolate_varyings(tri, bar, draw.shader->nvaryings, varying);
+                const bool derivatives = draw.shader->derivatives;
+                if (derivatives) quad_derivatives(tri, x, y, draw.shader->nvaryings, ddx, ddy);
+                auto [discard, color] = draw.shader->fragment(tri.face, bar, varying, derivatives ? ddx : nullptr,
+                                                              derivatives ? ddy : nullptr);
+                if (discard) {
+                    discarded++;
+                    continue;
+                }
+                framebuffer.set(x, y, color);
+                shaded++;
+            }
         }
     }
+
+    // ɫ׶εļֻܼ֡ϣʱ޷ָλ
+    frame_counters.shaded += shaded + discarded;
+    frame_counters.discarded += discarded;
+    frame_counters.writes += shaded;
+
+    // һ֡ջбɼԻ
+    vis_draws.clear();
+    std::fill(visbuffer.begin(), visbuffer.end(), VIS_EMPTY);
+    return shaded;
+}
+
+// ------------------- Դķֿ޳ -------------------
+static std::vector<PointLight> lights_eye;
+std::vector<std::vector<int>> detail::light_tiles;
+thread_local const std::vector<int>* detail::bound_lights = nullptr;
+
+void set_point_lights(const std::vector<PointLight>& lights, const int width, const int height) {
+    const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    lights_eye = lights;
+    light_tiles.assign(tiles_x * tiles_y, {});
+
+    for (int i = 0; i < static_cast<int>(lights.size()); i++) {
+        const vec4 p = render_state.modelview() * vec4{ lights[i].position.x, lights[i].position.y, lights[i].position.z, 1. };
+        lights_eye[i].position = p.xyz();
+
+        // ӰϵΧе 8 ǵͶӰĻȡΧУнǵڽƽ֮ʱĻ
+        const double r = lights[i].radius;
+        double xmin = 0, xmax = width - 1, ymin = 0, ymax = height - 1;
+        bool bounded = true;
+        double bx[2] = { HUGE_VAL, -HUGE_VAL }, by[2] = { HUGE_VAL, -HUGE_VAL };
+        for (int corner = 0; corner < 8; corner++) {
+            const vec4 clip = render_state.perspective() * vec4{ p.x + (corner & 1 ? r : -r), p.y + (corner & 2 ? r : -r), p.z + (corner & 4 ? r : -r), 1. };
+            if (clip.w < NEAR_W) { bounded = false; break; }
+            const vec4 screen = render_state.viewport() * (clip / clip.w);
+            bx[0] = std::min(bx[0], screen.x); bx[1] = std::max(bx[1], screen.x);
+            by[0] = std::min(by[0], screen.y); by[1] = std::max(by[1], screen.y);
+        }
+        if (bounded) {
+            xmin = std::max(bx[0], 0.); xmax = std::min(bx[1], width - 1.);
+            ymin = std::max(by[0], 0.); ymax = std::min(by[1], height - 1.);
+            if (xmin > xmax || ymin > ymax) continue; // ȫĻ
+        }
+        for (int ty = static_cast<int>(ymin) / TILE_SIZE; ty <= static_cast<int>(ymax) / TILE_SIZE; ty++)
+            for (int tx = static_cast<int>(xmin) / TILE_SIZE; tx <= static_cast<int>(xmax) / TILE_SIZE; tx++)
+                light_tiles[tx + ty * tiles_x].push_back(i);
+    }
+}
+
+const std::vector<PointLight>& eye_lights() {
+    return lights_eye;
+}
+
+void detail::bind_tile_lights(const int tile) {
+    bound_lights = tile < static_cast<int>(light_tiles.size()) ? &light_tiles[tile] : nullptr;
+}
+
+const std::vector<int>& tile_lights() {
+    static const std::vector<int> none;
+    return bound_lights ? *bound_lights : none;
 }
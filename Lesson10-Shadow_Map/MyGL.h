@@ -1,6 +1,72 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <vector>
 #include "tgaimage.h" 
 #include "geometry.h"   
 
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+class Model;
+
+// ------------------- Ĺ -------------------
+//  constexpr̶ʱڱ render_state.set_* 
+
+// ӽǣת * ƽ
+constexpr mat<4, 4> lookat_matrix(const vec3 eye, const vec3 center, const vec3 up) {
+    const vec3 n = normalized(eye - center);          // ߷
+    const vec3 l = normalized(cross(up, n));          // ҷ
+    const vec3 m = normalized(cross(n, l));           // Ϸ
+    return mat<4, 4>{ { {l.x,l.y,l.z,0}, {m.x,m.y,m.z,0}, {n.x,n.y,n.z,0}, {0,0,0,1} } } *
+           mat<4, 4>{ { {1,0,0,-center.x}, {0,1,0,-center.y}, {0,0,1,-center.z}, {0,0,0,1} } };
+}
+
+// ͸Ӿf Ϊ۵㵽ͶӰĵľ
+constexpr mat<4, 4> perspective_matrix(const double f) {
+    return { { {1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,-1 / f,1} } };
+}
+
+// ׼豸꣨[-1,1]ӳ䵽Ļ
+constexpr mat<4, 4> viewport_matrix(const int x, const int y, const int w, const int h) {
+    return { { {w / 2., 0, 0, x + w / 2.},
+               {0, h / 2., 0, y + h / 2.},
+               {0,0,1,0},
+               {0,0,0,1} } };
+}
+
+// ------------------- Ⱦ״̬ -------------------
+// ModelViewPerspectiveViewport Լľ
+// ֻͨ lookat / init_perspective / init_viewport  set_* ޸ģ޸ʱʧЧ
+// ʧЧһζȡʱ¼㣬֮һֱãɫÿȡ normal_matrix() ظ
+// ȡڲеĶ׶νУ޸Ĳͬʱ
+class RenderState {
+public:
+    const mat<4, 4>& modelview() const { return ModelView; }
+    const mat<4, 4>& perspective() const { return Perspective; }
+    const mat<4, 4>& viewport() const { return Viewport; }
+    const mat<4, 4>& normal_matrix() const; // ModelView תãڱ任
+    const mat<4, 4>& mvp() const;           // Perspective * ModelView
+
+    void set_modelview(const mat<4, 4>& m);
+    void set_perspective(const mat<4, 4>& m);
+    void set_viewport(const mat<4, 4>& m);
+
+private:
+    void update() const; // ʧЧʱ¼㣬߳ͬʱȡʱֻһ̼߳
+
+    mat<4, 4> ModelView, Perspective, Viewport;
+    mutable mat<4, 4> NormalMatrix, MVP;
+    mutable std::atomic<bool> fresh = false; // Ƿһ
+    mutable std::mutex update_mutex;
+};
+
+extern RenderState render_state; // ȫȾ״̬
+
 // ӽǵĺ
 void lookat(const vec3 eye, const vec3 center, const vec3 up);
 
@@ -10,19 +76,205 @@ void init_perspective(const double f);
 // ʼӿھĻӳ䣩
 void init_viewport(const int x, const int y, const int w, const int h);
 
-// ʼȻ棨Z-buffer
-void init_zbuffer(const int width, const int height);
+// ȻĴ洢ʽ
+// Float64 ÿ 8 ֽڣֱӴ NDC.z
+// Float32 ÿ 4 ֽڣ Z 1/wԽԽԶΪ 0
+// Fixed24 ÿ 4 ֽڣ 24 λЧ 1/w  24 λ㣬ƽ洦Ϊֵ
+enum class DepthFormat { Float64, Float32, Fixed24 };
+
+// ʼȻ棨Z-buffer Z ͸Ӿ init_perspective ֮
+void init_zbuffer(const int width, const int height, const DepthFormat format = DepthFormat::Float64);
+
+// ------------------- ٹѧ -------------------
+// ƬԪɫ pow 뵥λĽư汾ԾȻٶȣɫѡǷʹ
+
+// ߹ָұx^exponent  [0,1] ϾȲ size ΣʱԲֵx  [0,1] ʱض
+class SpecularTable {
+public:
+    explicit SpecularTable(const double exponent, const int size = 1024);
+    float operator()(const float x) const {
+        const float t = std::clamp(x, 0.f, 1.f) * size;
+        const int i = std::min(static_cast<int>(t), size - 1);
+        return table[i] + (table[i + 1] - table[i]) * (t - i);
+    }
+private:
+    int size;
+    std::vector<float> table; // size + 1 
+};
+
+// ƽӲֵ12 λȣһţٵԼ 1e-7
+inline float fast_rsqrt(const float x) {
+#if defined(__SSE__) || defined(_M_X64)
+    const float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return y * (1.5f - .5f * x * y * y);
+#else
+    return 1.f / std::sqrt(x);
+#endif
+}
+
+//  fast_rsqrt  sqrt ĵλ
+template<int n> vec<n> fast_normalized(const vec<n>& v) {
+    return v * static_cast<double>(fast_rsqrt(static_cast<float>(v * v)));
+}
+
+// ÿɵǼǵ varying double
+constexpr int MAX_VARYINGS = 16;
+
+// ƬԪͬһεһ 2x2 ؿ飬 SIMD ǲԵ 4 ͨһһӦ
+// ṹ飨SoAţbar[i][k] Ϊ k ͨ͸ĵ i ꣬
+// varying[j][k] Ϊ k ֵͨĵ j  varying ֻǰ nvaryings Ч
+// ЧͨͬߺƲֵأɫԲ mask ֱӼͨ
+// ddx/ddy Ϊؿ鹲õĻռ䵼ͨ 1ͨ 2 ͨ 0  varying ֮
+struct FragmentPacket {
+    static constexpr int LANES = 4;
+    int face;              // ڱе±
+    int x, y;              // ص꣨Ϊż k ͨΪ (x + (k & 1), y + (k >> 1))
+    int mask;              // ЧͨͨȲԣ
+    double bar[3][LANES];
+    double varying[MAX_VARYINGS][LANES];
+    double ddx[MAX_VARYINGS], ddy[MAX_VARYINGS];
+};
 
-// ɫӿڣƬԪɫ
+// ɫӿڣ嶥ƬԪɫ
+// face Ϊڱе±ꡣ׶ζÿΨһ㣨Model::cornerֻеһ vertex()
+// öθý varying Ҫ model.corner(face, vert) 
+//
+// ʽ varyingɫ declare_varying ǼÿҪֵԣn ά double 
+//  allocate_varyings ģ͵Ψһ洢vertex()  set_varying д롣
+// դʱνԤø /wÿֻһεܵõ͸Ĳֵ
+//  varying 齻 fragment() get_varying Ǽǵƫȡ
 struct IShader {
     static TGAColor sample2D(const TGAImage& img, const vec2& uvf) {
         return img.get(uvf[0] * img.width(), uvf[1] * img.height());
     }
-    virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const = 0;
+    virtual vec4 vertex(const int face, const int vert) = 0;
+    // ׶οʼǰһΣᲢеã transform_stream 任ģ͵Ķvertex() а±ȡ
+    virtual void prepare(const Model& model) {}
+    // ͼԪ vertex() ýÿεһΣԤֻйص
+    //  vertex() һᱻеãӦ face 
+    virtual void setup(const int face) {}
+    // bar Ϊ͸꣬varying Ϊֵõ varying 
+    // ddx/ddy Ϊ varying Ļ xy ϵĵ 2x2 ؿֻ derivatives Ϊ true ʱż㣬Ϊָ
+    virtual std::pair<bool, TGAColor> fragment(const int face, const vec3 bar, const double* varying,
+                                               const double* ddx, const double* ddy) const = 0;
+    // ƬԪɫһΪ 4 ƬԪɫرͨ룬Чͨɫᱻʹ
+    // Ĭ fragment()ɫдΪʵ֣Ӧ fragment() һ
+    // դԾɫͲûдʱֱ detail::fragment_lanes ͨ
+    virtual int fragment_packet(const FragmentPacket& packet, TGAColor color[FragmentPacket::LANES]) const;
+
+    // Ǽһ n ά varyingÿ varying еƫ
+    //  MAX_VARYINGS ʱֹκι¶飩
+    int declare_varying(const int n);
+    //  varying Ǽ󣬰ģ͵Ψһ洢
+    void allocate_varyings(const Model& model);
+    template<int n> void set_varying(const int corner, const int slot, const vec<n>& v) {
+        for (int i = 0; i < n; i++) varying_data[corner * nvaryings + slot + i] = static_cast<real>(v[i]);
+    }
+    // varying ȿǲֵdoubleҲ vertex_varyings صĶ洢real
+    template<int n, typename T> static vec<n> get_varying(const T* varying, const int slot) {
+        vec<n> v;
+        for (int i = 0; i < n; i++) v[i] = varying[slot + i];
+        return v;
+    }
+    //  face  vert  varying 
+    const real* vertex_varyings(const int face, const int vert) const;
+
+    int nvaryings = 0;                  // ÿ varying 
+    bool derivatives = false;           // ƬԪɫǷҪ ddx/ddy·ֻҪʱֵ
+private:
+    const Model* varying_model = nullptr;
+    std::vector<real> varying_data;     // ΨһŴţÿ nvaryings 
 };
 
+// դǲԵʵ֣زԣ SIMD һβһ 2x2 ؿ
+// δ SIMD ں˵ƽ̨ set_raster_path Чʼʹñ·
+enum class RasterPath { Scalar, SIMD };
+void set_raster_path(const RasterPath path);
+RasterPath get_raster_path();
+
+// Ȳ/ɫģʽԤȾظɫ
+// Normal     ͨȲ + ɫ
+// DepthOnly  һ飬ֻȲԲд zbufferƬԪɫ
+// DepthEqual ڶ飬ֻ zbuffer ȫȵƬԪɫɫѸصȻɱǣ
+//            ͬһȵĺƬԪʽºܳɫ뵥Ⱦһ
+// ʹͬκͬ RasterPathֵȲŻλ
+// Visibility ɼԻ壬ֻȲԲ¼ÿص (Ʊ, α)
+//            лƽ resolve_visibility ΪÿɼصһƬԪɫ
+enum class RasterMode { Normal, DepthOnly, DepthEqual, Visibility };
+void set_raster_mode(const RasterMode mode);
+
 // ͣά
-typedef vec4 Triangle[3];
+typedef std::array<vec4, 3> Triangle;
+
+// ĹդһƬԪƵ֡
+// ڲüռжԽƽ棨۵ 0.1f x/y βü͸ӳ
+// Ƚ䵽 64x64 Ļ飬ɸ̶߳ռȲɫ
+// ڰύ˳˽봮лһ
+// ȷԣÿءÿֻһ̶̰߳˳д룬ͣ
+// ͼͳ߳͵޹أ߳ȾĽֱοͼλȽ
+// ͨȲԵƬԪDepthOnly ¼ԤȾʱҪɫƬԪģʽΪʵɫ
+long long rasterize(const std::vector<Triangle>& clip, const IShader& shader, TGAImage& framebuffer);
+
+// ģ汾ɫڱ֪ƬԪɫ麯ãǲѭ
+// ɫͣ PhongShaderʱؾԶѡ const IShader& ð汾
+template<typename Shader> long long rasterize(const std::vector<Triangle>& clip, const Shader& shader, TGAImage& framebuffer);
+
+// ׶Σȵһ prepare()ٲеΪģ͵ÿΨһ (v, vt, vn) һ vertex()
+// Ϊÿεһ setup()زüռ
+std::vector<Triangle> vertex_stage(const Model& model, IShader& shader);
+
+// ȥصۼͳƣcorners Ϊζ㣨ÿ 3 vertex_calls Ϊʵʵ vertex() Ĵ
+// ģΨһ (v, vt, vn) ĸֻʱõĻ
+struct VertexDedupStats {
+    long long corners = 0, vertex_calls = 0;
+};
+VertexDedupStats vertex_dedup_stats();
+
+// ߸׶εļ
+struct PipelineStats {
+    long long triangles = 0;    // ύ
+    long long culled = 0;       // /СԣABC.det() < 1޳ΣüΣ
+    long long clipped = 0;      // Ҫβü
+    long long hiz_rejected = 0; //  Hi-Z İΧ
+    long long bbox_pixels = 0;  // رİΧ
+    long long covered = 0;      // ڵ
+    long long depth_failed = 0; // ڵδͨȲԵ
+    long long shaded = 0;       // ƬԪɫƬԪ
+    long long discarded = 0;    // ƬԪɫƬԪ
+    long long writes = 0;       // д֡ƬԪ
+
+    PipelineStats& operator+=(const PipelineStats& other);
+};
+// һ rasterize õļɼԻģʽɫ׶εļֻ resolve_visibility ڵ֡
+PipelineStats draw_stats();
+// ֡һ init_zbuffer ۼƼ
+PipelineStats frame_stats();
+
+// һģͣ׶ + դֵͬ rasterize
+long long draw(const Model& model, IShader& shader, TGAImage& framebuffer);
+template<typename Shader> long long draw(const Model& model, Shader& shader, TGAImage& framebuffer);
+
+// ɼԻɫ׶Σӱߺؽÿɼص겢öӦƵƬԪɫ
+// λƵɫ˵ãƬԪʱԭɫƬԪ
+long long resolve_visibility(TGAImage& framebuffer);
+
+// ԴλΪ꣬color Ϊͨ (r, g, b) Ĺǿradius ֮ûй
+struct PointLight {
+    vec3 position;
+    vec3 color;
+    double radius;
+};
+
+// óĵԴб lookat/init_perspective/init_viewport ֮󡢻֮ǰ
+// Դ任ϵٰĻ飨դͬ 64x64 飩޳
+// ӰͶӰĻϵİΧиǵĿŻѸùԴԼĹԴб
+void set_point_lights(const std::vector<PointLight>& lights, const int width, const int height);
+
+// ϵµĵԴ± set_point_lights бһ
+const std::vector<PointLight>& eye_lights();
+
+// ǰƬԪĻĹԴ±ֻ꣬ fragment()/fragment_packet() еЧ
+const std::vector<int>& tile_lights();
 
-// ĹդƬԪƵ֡
-void rasterize(const Triangle& clip, const IShader& shader, TGAImage& framebuffer);
\ No newline at end of file
+// ģդʵ
+#include "rasterizer.h"
@@ -1,66 +1,83 @@
 #pragma once
+#include <algorithm>
 #include <cmath>
 #include <cassert>
 #include <iostream>
+#include <limits>
+#include <type_traits>
+
+// SIMD ָ⣺ AVX ʱ 256 λĴx64  SSE2
+// vec4 / mat4  rasterizer.h ĸǲԹĺ
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MYGL_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MYGL_SIMD_SSE2
+#endif
 
 // ----------------------
 // ʽģԪ̣ݹ㣩
-// ǰ dt ģ壬 mat Ҳ dt 
-template<int n> struct dt;
+// ǰ dt ģ壬 mat Ҳ dt ⣻inv ͬת
+template<int n, typename T> struct dt;
+template<int n, typename T> struct inv;
+
+// ģı T ĬΪ doublevec<3>  vec<3, double> ͬһ
+// ʱƵstd::type_identity_tvec<3, float> * 2.0 дճ
 
 // ----------------------
-// ͨģ vec<n>
+// ͨģ vec<n, T>
 // ----------------------
-template<int n> struct vec {
-    double data[n] = { 0 }; // 洢 n 
+template<int n, typename T = double> struct vec {
+    T data[n] = { 0 }; // 洢 n 
 
     // ±ʣɶд
-    double& operator[](const int i) { assert(i >= 0 && i < n); return data[i]; }
-    double  operator[](const int i) const { assert(i >= 0 && i < n); return data[i]; }
+    constexpr T& operator[](const int i) { assert(i >= 0 && i < n); return data[i]; }
+    constexpr T  operator[](const int i) const { assert(i >= 0 && i < n); return data[i]; }
 };
 
 // 
-template<int n> double operator*(const vec<n>& lhs, const vec<n>& rhs) {
-    double ret = 0;
+template<int n, typename T> constexpr T operator*(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+    T ret = 0;
     for (int i = n; i--; ret += lhs[i] * rhs[i]);
     return ret;
 }
 
 // ӷ
-template<int n> vec<n> operator+(const vec<n>& lhs, const vec<n>& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> constexpr vec<n, T> operator+(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+    vec<n, T> ret = lhs;
     for (int i = n; i--; ret[i] += rhs[i]);
     return ret;
 }
 
 // 
-template<int n> vec<n> operator-(const vec<n>& lhs, const vec<n>& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> constexpr vec<n, T> operator-(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+    vec<n, T> ret = lhs;
     for (int i = n; i--; ret[i] -= rhs[i]);
     return ret;
 }
 
 // ˱
-template<int n> vec<n> operator*(const vec<n>& lhs, const double& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> constexpr vec<n, T> operator*(const vec<n, T>& lhs, const std::type_identity_t<T>& rhs) {
+    vec<n, T> ret = lhs;
     for (int i = n; i--; ret[i] *= rhs);
     return ret;
 }
 
 // 
-template<int n> vec<n> operator*(const double& lhs, const vec<n>& rhs) {
+template<int n, typename T> constexpr vec<n, T> operator*(const std::type_identity_t<T>& lhs, const vec<n, T>& rhs) {
     return rhs * lhs;
 }
 
 // Ա
-template<int n> vec<n> operator/(const vec<n>& lhs, const double& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> constexpr vec<n, T> operator/(const vec<n, T>& lhs, const std::type_identity_t<T>& rhs) {
+    vec<n, T> ret = lhs;
     for (int i = n; i--; ret[i] /= rhs);
     return ret;
 }
 
 // 
-template<int n> std::ostream& operator<<(std::ostream& out, const vec<n>& v) {
+template<int n, typename T> std::ostream& operator<<(std::ostream& out, const vec<n, T>& v) {
     for (int i = 0; i < n; i++) out << v[i] << " ";
     return out;
 }
@@ -68,82 +85,123 @@ template<int n> std::ostream& operator<<(std::ostream& out, const vec<n>& v) {
 // ----------------------
 // ػ vec2, vec3, vec4
 // ----------------------
-template<> struct vec<2> {
-    double x = 0, y = 0;
-    double& operator[](const int i) { assert(i >= 0 && i < 2); return i ? y : x; }
-    double  operator[](const int i) const { assert(i >= 0 && i < 2); return i ? y : x; }
+// ±ͨԱָ members ʣ±ʱһβһζûз֧
+template<typename T> struct vec<2, T> {
+    T x = 0, y = 0;
+    static constexpr T vec::* members[] = { &vec::x, &vec::y };
+    constexpr T& operator[](const int i) { assert(i >= 0 && i < 2); return this->*members[i]; }
+    constexpr T  operator[](const int i) const { assert(i >= 0 && i < 2); return this->*members[i]; }
 };
 
-template<> struct vec<3> {
-    double x = 0, y = 0, z = 0;
-    double& operator[](const int i) { assert(i >= 0 && i < 3); return i ? (i == 1 ? y : z) : x; }
-    double  operator[](const int i) const { assert(i >= 0 && i < 3); return i ? (i == 1 ? y : z) : x; }
+template<typename T> struct vec<3, T> {
+    T x = 0, y = 0, z = 0;
+    static constexpr T vec::* members[] = { &vec::x, &vec::y, &vec::z };
+    constexpr T& operator[](const int i) { assert(i >= 0 && i < 3); return this->*members[i]; }
+    constexpr T  operator[](const int i) const { assert(i >= 0 && i < 3); return this->*members[i]; }
 };
 
-template<> struct vec<4> {
-    double x = 0, y = 0, z = 0, w = 0;
-    double& operator[](const int i) { assert(i >= 0 && i < 4); return i < 2 ? (i ? y : x) : (i == 2 ? z : w); }
-    double  operator[](const int i) const { assert(i >= 0 && i < 4); return i < 2 ? (i ? y : x) : (i == 2 ? z : w); }
+// ĴС루vec4 Ϊ 32 ֽڣx..w һ SIMD ָд
+template<typename T> struct alignas(4 * sizeof(T)) vec<4, T> {
+    T x = 0, y = 0, z = 0, w = 0;
+    static constexpr T vec::* members[] = { &vec::x, &vec::y, &vec::z, &vec::w };
+    constexpr T& operator[](const int i) { assert(i >= 0 && i < 4); return this->*members[i]; }
+    constexpr T  operator[](const int i) const { assert(i >= 0 && i < 4); return this->*members[i]; }
 
-    vec<2> xy()  const { return { x, y }; }
-    vec<3> xyz() const { return { x, y, z }; }
+    constexpr vec<2, T> xy()  const { return { x, y }; }
+    constexpr vec<3, T> xyz() const { return { x, y, z }; }
 };
 
 typedef vec<2> vec2;
 typedef vec<3> vec3;
 typedef vec<4> vec4;
+typedef vec<2, float> vec2f;
+typedef vec<3, float> vec3f;
+typedef vec<4, float> vec4f;
+
+// תͣ vec_cast<float>(v)
+template<typename U, int n, typename T> constexpr vec<n, U> vec_cast(const vec<n, T>& v) {
+    vec<n, U> ret;
+    for (int i = n; i--; ret[i] = static_cast<U>(v[i]));
+    return ret;
+}
+
+// ڿõƽʱԵ std::sqrt
+// ֵʱϷţٵֱټСȷֵ 1 ulp
+//  r * rDekker ˷жֵǷ r е֮⣬֤ std::sqrt λͬ
+template<typename T> constexpr T constexpr_sqrt(const T x) {
+    if (!std::is_constant_evaluated()) return std::sqrt(x);
+    if (!(x > 0) || x == std::numeric_limits<T>::infinity()) return x == 0 || x > 0 ? x : std::numeric_limits<T>::quiet_NaN();
+    T scale = 1; // С x ȷŴ 2 żݣ r * r ǹ
+    for (int i = 0; i < std::numeric_limits<T>::digits; i++) scale *= 2;
+    if (x < 1 / (scale * scale)) return constexpr_sqrt(x * scale * scale) / scale;
+    T r = x > 1 ? x : T(1);
+    for (T next = (r + x / r) / 2; next < r; next = (r + x / r) / 2) r = next;
+
+    T ulp = 1;
+    for (; r >= 2 * ulp; ulp *= 2);
+    for (; r < ulp; ulp /= 2);
+    const T down = (r == ulp ? ulp / 2 : ulp) * std::numeric_limits<T>::epsilon(); // r Ϊ 2 ʱ·ļ
+    ulp *= std::numeric_limits<T>::epsilon();
+    const T c = r * (T(1ull << ((std::numeric_limits<T>::digits + 1) / 2)) + 1), hi = c - (c - r), lo = r - hi;
+    const T p = r * r, e = ((hi * hi - p) + 2 * hi * lo) + lo * lo; // r * r = p + e
+    // ӽеʱÿһӼ˳û
+    if (((x - p) + r * down) - e < down * down / 4) return r - down; // x < (r - down / 2)^2
+    if (((x - p) - r * ulp) - e > ulp * ulp / 4) return r + ulp;     // x > (r + ulp / 2)^2
+    return r;
+}
 
-template<int n> double norm(const vec<n>& v) {
-    return std::sqrt(v * v);
+template<int n, typename T> constexpr T norm(const vec<n, T>& v) {
+    return constexpr_sqrt(v * v);
 }
 
-template<int n> vec<n> normalized(const vec<n>& v) {
+template<int n, typename T> constexpr vec<n, T> normalized(const vec<n, T>& v) {
     return v / norm(v);
 }
 
-template<int n>
-vec<n> operator-(const vec<n>& v) {
-    vec<n> ret = v;
+template<int n, typename T>
+constexpr vec<n, T> operator-(const vec<n, T>& v) {
+    vec<n, T> ret = v;
     for (int i = n; i--; ) ret[i] = -ret[i];
     return ret;
 }
 
 
-inline vec3 cross(const vec3& v1, const vec3& v2) {
+template<typename T> constexpr vec<3, T> cross(const vec<3, T>& v1, const vec<3, T>& v2) {
     return { v1.y * v2.z - v1.z * v2.y,
              v1.z * v2.x - v1.x * v2.z,
              v1.x * v2.y - v1.y * v2.x };
 }
 
 // ----------------------
-// ģ mat<nrows, ncols>
+// ģ mat<nrows, ncols, T>
 // ----------------------
-template<int nrows, int ncols> struct mat {
-    vec<ncols> rows[nrows] = { {} };
+template<int nrows, int ncols, typename T = double> struct mat {
+    vec<ncols, T> rows[nrows] = { {} };
 
-    vec<ncols>& operator[](const int idx) { assert(idx >= 0 && idx < nrows); return rows[idx]; }
-    const vec<ncols>& operator[](const int idx) const { assert(idx >= 0 && idx < nrows); return rows[idx]; }
+    constexpr vec<ncols, T>& operator[](const int idx) { assert(idx >= 0 && idx < nrows); return rows[idx]; }
+    constexpr const vec<ncols, T>& operator[](const int idx) const { assert(idx >= 0 && idx < nrows); return rows[idx]; }
 
-    double det() const { return dt<nrows>::det(*this); }
+    constexpr T det() const { return dt<nrows, T>::det(*this); }
 
-    double cofactor(const int row, const int col) const {
-        mat<nrows - 1, ncols - 1> submatrix;
+    // ȥ row С col кӾ
+    constexpr mat<nrows - 1, ncols - 1, T> submatrix(const int row, const int col) const {
+        mat<nrows - 1, ncols - 1, T> ret;
         for (int i = nrows - 1; i--; )
-            for (int j = ncols - 1; j--; submatrix[i][j] = rows[i + int(i >= row)][j + int(j >= col)]);
-        return submatrix.det() * ((row + col) % 2 ? -1 : 1);
+            for (int j = ncols - 1; j--; ret[i][j] = rows[i + int(i >= row)][j + int(j >= col)]);
+        return ret;
     }
 
-    mat<nrows, ncols> invert_transpose() const {
-        mat<nrows, ncols> adj;
-        for (int i = nrows; i--; )
-            for (int j = ncols; j--; adj[i][j] = cofactor(i, j));
-        return adj / (adj[0] * rows[0]);
+    constexpr T cofactor(const int row, const int col) const {
+        return submatrix(row, col).det() * ((row + col) % 2 ? -1 : 1);
     }
 
-    mat<nrows, ncols> invert() const { return invert_transpose().transpose(); }
+    // 234 Ϊʽʵ֣߽װʽչ
+    constexpr mat<nrows, ncols, T> invert_transpose() const { return inv<nrows, T>::invert_transpose(*this); }
+
+    constexpr mat<nrows, ncols, T> invert() const { return invert_transpose().transpose(); }
 
-    mat<ncols, nrows> transpose() const {
-        mat<ncols, nrows> ret;
+    constexpr mat<ncols, nrows, T> transpose() const {
+        mat<ncols, nrows, T> ret;
         for (int i = ncols; i--; )
             for (int j = nrows; j--; ret[i][j] = rows[j][i]);
         return ret;
@@ -153,66 +211,311 @@ template<int nrows, int ncols> struct mat {
 // ----------------------
 // /
 // ----------------------
-template<int nrows, int ncols> vec<ncols> operator*(const vec<nrows>& lhs, const mat<nrows, ncols>& rhs) {
-    return (mat<1, nrows>{{lhs}}*rhs)[0];
+template<int nrows, int ncols, typename T> constexpr vec<ncols, T> operator*(const vec<nrows, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+    return (mat<1, nrows, T>{{lhs}}*rhs)[0];
 }
 
-template<int nrows, int ncols> vec<nrows> operator*(const mat<nrows, ncols>& lhs, const vec<ncols>& rhs) {
-    vec<nrows> ret;
+template<int nrows, int ncols, typename T> constexpr vec<nrows, T> operator*(const mat<nrows, ncols, T>& lhs, const vec<ncols, T>& rhs) {
+    vec<nrows, T> ret;
     for (int i = nrows; i--; ret[i] = lhs[i] * rhs);
     return ret;
 }
 
-template<int R1, int C1, int C2> mat<R1, C2> operator*(const mat<R1, C1>& lhs, const mat<C1, C2>& rhs) {
-    mat<R1, C2> result;
+template<int R1, int C1, int C2, typename T> constexpr mat<R1, C2, T> operator*(const mat<R1, C1, T>& lhs, const mat<C1, C2, T>& rhs) {
+    mat<R1, C2, T> result;
     for (int i = R1; i--; )
         for (int j = C2; j--; )
             for (int k = C1; k--; result[i][j] += lhs[i][k] * rhs[k][j]);
     return result;
 }
 
-template<int nrows, int ncols> mat<nrows, ncols> operator*(const mat<nrows, ncols>& lhs, const double& val) {
-    mat<nrows, ncols> result;
+template<int nrows, int ncols, typename T> constexpr mat<nrows, ncols, T> operator*(const mat<nrows, ncols, T>& lhs, const std::type_identity_t<T>& val) {
+    mat<nrows, ncols, T> result;
     for (int i = nrows; i--; result[i] = lhs[i] * val);
     return result;
 }
 
-template<int nrows, int ncols> mat<nrows, ncols> operator/(const mat<nrows, ncols>& lhs, const double& val) {
-    mat<nrows, ncols> result;
+template<int nrows, int ncols, typename T> constexpr mat<nrows, ncols, T> operator/(const mat<nrows, ncols, T>& lhs, const std::type_identity_t<T>& val) {
+    mat<nrows, ncols, T> result;
     for (int i = nrows; i--; result[i] = lhs[i] / val);
     return result;
 }
 
-template<int nrows, int ncols> mat<nrows, ncols> operator+(const mat<nrows, ncols>& lhs, const mat<nrows, ncols>& rhs) {
-    mat<nrows, ncols> result;
+template<int nrows, int ncols, typename T> constexpr mat<nrows, ncols, T> operator+(const mat<nrows, ncols, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+    mat<nrows, ncols, T> result;
     for (int i = nrows; i--; )
         for (int j = ncols; j--; result[i][j] = lhs[i][j] + rhs[i][j]);
     return result;
 }
 
-template<int nrows, int ncols> mat<nrows, ncols> operator-(const mat<nrows, ncols>& lhs, const mat<nrows, ncols>& rhs) {
-    mat<nrows, ncols> result;
+template<int nrows, int ncols, typename T> constexpr mat<nrows, ncols, T> operator-(const mat<nrows, ncols, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+    mat<nrows, ncols, T> result;
     for (int i = nrows; i--; )
         for (int j = ncols; j--; result[i][j] = lhs[i][j] - rhs[i][j]);
     return result;
 }
 
-template<int nrows, int ncols> std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols>& m) {
+template<int nrows, int ncols, typename T> std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols, T>& m) {
     for (int i = 0; i < nrows; i++) out << m[i] << std::endl;
     return out;
 }
 
+// ----------------------
+// vec4 / mat4double SIMD 汾
+// ģͨģ壻ֵʱͨģ
+// ĳ˼˳ͨģһ£± 3 ۼӵ 0 FMAλͬ
+// ----------------------
+#if defined(MYGL_SIMD_AVX) || defined(MYGL_SIMD_SSE2)
+constexpr vec<4> operator+(const vec<4>& lhs, const vec<4>& rhs) {
+    if (std::is_constant_evaluated()) return operator+<4, double>(lhs, rhs);
+    vec<4> ret;
+#if defined(MYGL_SIMD_AVX)
+    _mm256_store_pd(&ret.x, _mm256_add_pd(_mm256_load_pd(&lhs.x), _mm256_load_pd(&rhs.x)));
+#else
+    _mm_store_pd(&ret.x, _mm_add_pd(_mm_load_pd(&lhs.x), _mm_load_pd(&rhs.x)));
+    _mm_store_pd(&ret.z, _mm_add_pd(_mm_load_pd(&lhs.z), _mm_load_pd(&rhs.z)));
+#endif
+    return ret;
+}
+
+constexpr vec<4> operator-(const vec<4>& lhs, const vec<4>& rhs) {
+    if (std::is_constant_evaluated()) return operator-<4, double>(lhs, rhs);
+    vec<4> ret;
+#if defined(MYGL_SIMD_AVX)
+    _mm256_store_pd(&ret.x, _mm256_sub_pd(_mm256_load_pd(&lhs.x), _mm256_load_pd(&rhs.x)));
+#else
+    _mm_store_pd(&ret.x, _mm_sub_pd(_mm_load_pd(&lhs.x), _mm_load_pd(&rhs.x)));
+    _mm_store_pd(&ret.z, _mm_sub_pd(_mm_load_pd(&lhs.z), _mm_load_pd(&rhs.z)));
+#endif
+    return ret;
+}
+
+constexpr vec<4> operator*(const vec<4>& lhs, const double rhs) {
+    if (std::is_constant_evaluated()) return operator*<4, double>(lhs, rhs);
+    vec<4> ret;
+#if defined(MYGL_SIMD_AVX)
+    _mm256_store_pd(&ret.x, _mm256_mul_pd(_mm256_load_pd(&lhs.x), _mm256_set1_pd(rhs)));
+#else
+    _mm_store_pd(&ret.x, _mm_mul_pd(_mm_load_pd(&lhs.x), _mm_set1_pd(rhs)));
+    _mm_store_pd(&ret.z, _mm_mul_pd(_mm_load_pd(&lhs.z), _mm_set1_pd(rhs)));
+#endif
+    return ret;
+}
+
+constexpr vec<4> operator*(const double lhs, const vec<4>& rhs) {
+    return rhs * lhs;
+}
+
+constexpr vec<4> operator/(const vec<4>& lhs, const double rhs) {
+    if (std::is_constant_evaluated()) return operator/<4, double>(lhs, rhs);
+    vec<4> ret;
+#if defined(MYGL_SIMD_AVX)
+    _mm256_store_pd(&ret.x, _mm256_div_pd(_mm256_load_pd(&lhs.x), _mm256_set1_pd(rhs)));
+#else
+    _mm_store_pd(&ret.x, _mm_div_pd(_mm_load_pd(&lhs.x), _mm_set1_pd(rhs)));
+    _mm_store_pd(&ret.z, _mm_div_pd(_mm_load_pd(&lhs.z), _mm_set1_pd(rhs)));
+#endif
+    return ret;
+}
+
+// Ȱ 4 תó 4 У v ĸ㲥ۼӣҪˮƽ
+constexpr vec<4> operator*(const mat<4, 4>& lhs, const vec<4>& rhs) {
+    if (std::is_constant_evaluated()) return operator*<4, 4, double>(lhs, rhs);
+    vec<4> ret;
+#if defined(MYGL_SIMD_AVX)
+    const __m256d r0 = _mm256_load_pd(&lhs[0].x), r1 = _mm256_load_pd(&lhs[1].x);
+    const __m256d r2 = _mm256_load_pd(&lhs[2].x), r3 = _mm256_load_pd(&lhs[3].x);
+    const __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1); // m00 m10 m02 m12 / m01 m11 m03 m13
+    const __m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3); // m20 m30 m22 m32 / m21 m31 m23 m33
+    __m256d acc = _mm256_setzero_pd();
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_permute2f128_pd(t1, t3, 0x31), _mm256_set1_pd(rhs.w)));
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_permute2f128_pd(t0, t2, 0x31), _mm256_set1_pd(rhs.z)));
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_permute2f128_pd(t1, t3, 0x20), _mm256_set1_pd(rhs.y)));
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_permute2f128_pd(t0, t2, 0x20), _mm256_set1_pd(rhs.x)));
+    _mm256_store_pd(&ret.x, acc);
+#else
+    // ÿУͰ벿Ϊ i У߰벿Ϊ i + 1 
+    for (int i : {0, 2}) {
+        const __m128d a01 = _mm_load_pd(&lhs[i].x), a23 = _mm_load_pd(&lhs[i].z);
+        const __m128d b01 = _mm_load_pd(&lhs[i + 1].x), b23 = _mm_load_pd(&lhs[i + 1].z);
+        __m128d acc = _mm_setzero_pd();
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_unpackhi_pd(a23, b23), _mm_set1_pd(rhs.w)));
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_unpacklo_pd(a23, b23), _mm_set1_pd(rhs.z)));
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_unpackhi_pd(a01, b01), _mm_set1_pd(rhs.y)));
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_unpacklo_pd(a01, b01), _mm_set1_pd(rhs.x)));
+        _mm_store_pd(&ret[i], acc);
+    }
+#endif
+    return ret;
+}
+
+// ˾󣺽ĵ i  rhs а lhs[i] ķȨ
+constexpr mat<4, 4> operator*(const mat<4, 4>& lhs, const mat<4, 4>& rhs) {
+    if (std::is_constant_evaluated()) return operator*<4, 4, 4, double>(lhs, rhs);
+    mat<4, 4> ret;
+    for (int i = 4; i--; ) {
+#if defined(MYGL_SIMD_AVX)
+        __m256d acc = _mm256_setzero_pd();
+        for (int k = 4; k--; )
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_set1_pd(lhs[i][k]), _mm256_load_pd(&rhs[k].x)));
+        _mm256_store_pd(&ret[i].x, acc);
+#else
+        __m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+        for (int k = 4; k--; ) {
+            const __m128d l = _mm_set1_pd(lhs[i][k]);
+            lo = _mm_add_pd(lo, _mm_mul_pd(l, _mm_load_pd(&rhs[k].x)));
+            hi = _mm_add_pd(hi, _mm_mul_pd(l, _mm_load_pd(&rhs[k].z)));
+        }
+        _mm_store_pd(&ret[i].x, lo);
+        _mm_store_pd(&ret[i].z, hi);
+#endif
+    }
+    return ret;
+}
+#endif
+
+// ----------------------
+// SoA 任(ox, oy, oz, ow)[i] = m * (x[i], y[i], z[i], w) n 
+//  real 洢Ϊ doubleÿĳ˼˳ mat * vec ͬλһ
+// ţѭһָڵļ㣩ʱٷָ߳
+// ----------------------
+template<typename T> void transform_stream(const mat<4, 4>& m, const T* x, const T* y, const T* z, const double w, const int n,
+                                           double* ox, double* oy, double* oz, double* ow) {
+    constexpr int chunk = 4096;
+#pragma omp parallel for if(n >= 16 * chunk)
+    for (int begin = 0; begin < n; begin += chunk) {
+        // Ƶֲ鲻صѭﲻ¶ȡ
+        const mat<4, 4> a = m;
+        const vec4 aw = { 0 + a[0][3] * w, 0 + a[1][3] * w, 0 + a[2][3] * w, 0 + a[3][3] * w };
+        const int end = std::min(begin + chunk, n);
+#pragma omp simd
+        for (int i = begin; i < end; i++) {
+            const double vx = x[i], vy = y[i], vz = z[i];
+            ox[i] = ((aw.x + a[0][2] * vz) + a[0][1] * vy) + a[0][0] * vx;
+            oy[i] = ((aw.y + a[1][2] * vz) + a[1][1] * vy) + a[1][0] * vx;
+            oz[i] = ((aw.z + a[2][2] * vz) + a[2][1] * vy) + a[2][0] * vx;
+            ow[i] = ((aw.w + a[3][2] * vz) + a[3][1] * vy) + a[3][0] * vx;
+        }
+    }
+}
+
 // ----------------------
 // ʽģԪʵ
 // ----------------------
-template<int n> struct dt {
-    static double det(const mat<n, n>& src) {
-        double ret = 0;
+template<int n, typename T> struct dt {
+    static constexpr T det(const mat<n, n, T>& src) {
+        T ret = 0;
         for (int i = n; i--; ret += src[0][i] * src.cofactor(0, i));
         return ret;
     }
 };
 
-template<> struct dt<1> {
-    static double det(const mat<1, 1>& src) { return src[0][0]; }
+template<typename T> struct dt<1, T> {
+    static constexpr T det(const mat<1, 1, T>& src) { return src[0][0]; }
+};
+
+template<typename T> struct dt<2, T> {
+    static constexpr T det(const mat<2, 2, T>& m) { return m[0][0] * m[1][1] - m[0][1] * m[1][0]; }
+};
+
+template<typename T> struct dt<3, T> {
+    static constexpr T det(const mat<3, 3, T>& m) {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+             - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+             + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+};
+
+// ----------------------
+// תãʽ / ʽ
+// ʽػֻһγٳʽĵ
+// ----------------------
+template<int n, typename T> struct inv {
+    static constexpr mat<n, n, T> invert_transpose(const mat<n, n, T>& src) {
+        mat<n, n, T> adj;
+        for (int i = n; i--; )
+            for (int j = n; j--; adj[i][j] = src.cofactor(i, j));
+        return adj / (adj[0] * src[0]);
+    }
+};
+
+template<typename T> struct inv<2, T> {
+    static constexpr mat<2, 2, T> invert_transpose(const mat<2, 2, T>& m) {
+        const T inv_det = 1 / (m[0][0] * m[1][1] - m[0][1] * m[1][0]);
+        return { { { m[1][1] * inv_det, -m[1][0] * inv_det }, { -m[0][1] * inv_det, m[0][0] * inv_det } } };
+    }
+};
+
+// 3 ףʽĸоеĲ
+template<typename T> struct inv<3, T> {
+    static constexpr mat<3, 3, T> invert_transpose(const mat<3, 3, T>& m) {
+        const vec<3, T> c0 = cross(m[1], m[2]), c1 = cross(m[2], m[0]), c2 = cross(m[0], m[1]);
+        const T inv_det = 1 / (c0 * m[0]);
+        return { { c0 * inv_det, c1 * inv_det, c2 * inv_det } };
+    }
 };
+
+// 4 ףе 2x2 ʽ˵õʽLaplace չÿʽʽ
+template<typename T> struct inv<4, T> {
+    static constexpr mat<4, 4, T> invert_transpose(const mat<4, 4, T>& m) {
+        const T s0 = m[0][0] * m[1][1] - m[1][0] * m[0][1], s1 = m[0][0] * m[1][2] - m[1][0] * m[0][2];
+        const T s2 = m[0][0] * m[1][3] - m[1][0] * m[0][3], s3 = m[0][1] * m[1][2] - m[1][1] * m[0][2];
+        const T s4 = m[0][1] * m[1][3] - m[1][1] * m[0][3], s5 = m[0][2] * m[1][3] - m[1][2] * m[0][3];
+        const T c5 = m[2][2] * m[3][3] - m[3][2] * m[2][3], c4 = m[2][1] * m[3][3] - m[3][1] * m[2][3];
+        const T c3 = m[2][1] * m[3][2] - m[3][1] * m[2][2], c2 = m[2][0] * m[3][3] - m[3][0] * m[2][3];
+        const T c1 = m[2][0] * m[3][2] - m[3][0] * m[2][2], c0 = m[2][0] * m[3][1] - m[3][0] * m[2][1];
+        const T inv_det = 1 / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+        const mat<4, 4, T> cof = { {
+            {  m[1][1] * c5 - m[1][2] * c4 + m[1][3] * c3, -m[1][0] * c5 + m[1][2] * c2 - m[1][3] * c1,
+               m[1][0] * c4 - m[1][1] * c2 + m[1][3] * c0, -m[1][0] * c3 + m[1][1] * c1 - m[1][2] * c0 },
+            { -m[0][1] * c5 + m[0][2] * c4 - m[0][3] * c3,  m[0][0] * c5 - m[0][2] * c2 + m[0][3] * c1,
+              -m[0][0] * c4 + m[0][1] * c2 - m[0][3] * c0,  m[0][0] * c3 - m[0][1] * c1 + m[0][2] * c0 },
+            {  m[3][1] * s5 - m[3][2] * s4 + m[3][3] * s3, -m[3][0] * s5 + m[3][2] * s2 - m[3][3] * s1,
+               m[3][0] * s4 - m[3][1] * s2 + m[3][3] * s0, -m[3][0] * s3 + m[3][1] * s1 - m[3][2] * s0 },
+            { -m[2][1] * s5 + m[2][2] * s4 - m[2][3] * s3,  m[2][0] * s5 - m[2][2] * s2 + m[2][3] * s1,
+              -m[2][0] * s4 + m[2][1] * s2 - m[2][3] * s0,  m[2][0] * s3 - m[2][1] * s1 + m[2][2] * s0 } } };
+        return cof * inv_det;
+    }
+};
+
+// 任һΪ 0 0 0 1棺[A t] Ϊ [A^-1  -A^-1 t]ֻ 3 ׵
+// A^-1 ĵ j  A еĲʽ inv<3> ͬ
+template<typename T> constexpr mat<4, 4, T> invert_affine(const mat<4, 4, T>& m) {
+    const vec<3, T> r0 = m[0].xyz(), r1 = m[1].xyz(), r2 = m[2].xyz();
+    const vec<3, T> c0 = cross(r1, r2), c1 = cross(r2, r0), c2 = cross(r0, r1);
+    const T inv_det = 1 / (c0 * r0);
+    mat<4, 4, T> ret;
+    for (int i = 3; i--; ) {
+        ret[i] = { c0[i] * inv_det, c1[i] * inv_det, c2[i] * inv_det, 0 };
+        ret[i][3] = -(ret[i][0] * m[0][3] + ret[i][1] * m[1][3] + ret[i][2] * m[2][3]);
+    }
+    ret[3] = { 0, 0, 0, 1 };
+    return ret;
+}
+
+// ʽչʽתãıʽػУԱȱʽ汾
+template<int n, typename T> constexpr T det_cofactor(const mat<n, n, T>& m) {
+    if constexpr (n == 1) return m[0][0];
+    else {
+        T ret = 0;
+        for (int i = n; i--; ret += m[0][i] * det_cofactor(m.submatrix(0, i)) * (i % 2 ? -1 : 1));
+        return ret;
+    }
+}
+
+template<int n, typename T> constexpr mat<n, n, T> invert_transpose_cofactor(const mat<n, n, T>& m) {
+    mat<n, n, T> adj;
+    for (int i = n; i--; )
+        for (int j = n; j--; adj[i][j] = det_cofactor(m.submatrix(i, j)) * ((i + j) % 2 ? -1 : 1));
+    return adj / (adj[0] * m[0]);
+}
+
+// ----------------------
+// Ⱦߴ洢ݣģ͵Ķ㡢ߡ붥 varyingõı
+// Ĭ doubleCMake ѡ float_storage ʱΪ float洢룬԰ double 
+// ----------------------
+#ifdef MYGL_FLOAT_STORAGE
+typedef float real;
+#else
+typedef double real;
+#endif
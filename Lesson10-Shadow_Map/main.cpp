@@ -1,62 +1,480 @@
 #include "MyGL.h"
 #include "modelLoader.h"
 #include <algorithm>
+#include <chrono>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <vector>
 #include <iostream>
+#include <random>
+#include <string>
 
-extern mat<4, 4> Viewport, ModelView, Perspective;
 extern std::vector<double> zbuffer;
 
 // ----------------- Phong Shader -----------------
-struct PhongShader : IShader {
+struct PhongShader final : IShader {
     const Model& model;
-    vec4 l;              // Դϵ
-    vec2 varying_uv[3];  //  UV
-    vec4 varying_nrm[3]; // 㷨
-    vec4 tri[3];         // ζ㣨ϵ
+    vec4 l;                        // Դϵ
+    const int varying_uv = declare_varying(2);  //  UV
+    const int varying_nrm = declare_varying(4); // 㷨ߣϵ
+    const int varying_pos = declare_varying(3); // λãϵڵԴ
+    std::vector<vec<4, real>> varying_tri;     // λãϵֻ setup() ʹãΨһŴ
+    std::vector<double> eye_pos[4], eye_nrm[4]; // ģͱ任ϵĶ뷨 prepare() 
+    std::vector<mat<2, 4, real>> tangent_basis; // ÿε븱ߣѵλ setup() 
+    bool fast_math = false;        // ʹ floatfast_rsqrt ߹ұ
+    bool show_lod = false;         // գ uv  mip ɫ
+    inline static const SpecularTable specular_pow{ 35. }; // x^35
 
-    PhongShader(const vec3 light, const Model& m) : model(m) {
-        l = normalized(ModelView * vec4{ light.x, light.y, light.z, 0.0 });
+    PhongShader(const vec3 light, const Model& m) : model(m), varying_tri(m.ncorners()), tangent_basis(m.nfaces()) {
+        allocate_varyings(m);
+        l = normalized(render_state.modelview() * vec4{ light.x, light.y, light.z, 0.0 });
+    }
+
+    // 뷨߰ SoA һԱ任߾ȡ render_state Ļ
+    virtual void prepare(const Model& m) {
+        for (int i = 0; i < 4; i++) {
+            eye_pos[i].resize(m.nverts());
+            eye_nrm[i].resize(m.nnormals());
+        }
+        transform_stream(render_state.modelview(), m.vert_stream(0), m.vert_stream(1), m.vert_stream(2), 1., m.nverts(),
+                         eye_pos[0].data(), eye_pos[1].data(), eye_pos[2].data(), eye_pos[3].data());
+        transform_stream(render_state.normal_matrix(), m.normal_stream(0), m.normal_stream(1), m.normal_stream(2), 0., m.nnormals(),
+                         eye_nrm[0].data(), eye_nrm[1].data(), eye_nrm[2].data(), eye_nrm[3].data());
     }
 
     virtual vec4 vertex(const int face, const int vert) {
-        varying_uv[vert] = model.uv(face, vert);
-        varying_nrm[vert] = ModelView.invert_transpose() * model.normal(face, vert);
-        vec4 gl_Position = ModelView * model.vert(face, vert);
-        tri[vert] = gl_Position;
-        return Perspective * gl_Position;
+        const int c = model.corner(face, vert), v = model.vert_index(face, vert), n = model.normal_index(face, vert);
+        set_varying(c, varying_uv, model.uv(face, vert));
+        set_varying(c, varying_nrm, vec4{ eye_nrm[0][n], eye_nrm[1][n], eye_nrm[2][n], eye_nrm[3][n] });
+        vec4 gl_Position = { eye_pos[0][v], eye_pos[1][v], eye_pos[2][v], eye_pos[3][v] };
+        varying_tri[c] = vec_cast<real>(gl_Position);
+        set_varying(c, varying_pos, gl_Position.xyz());
+        return render_state.perspective() * gl_Position;
     }
 
-    virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const {
-        // ߿ռ Darboux frame
-        mat<2, 4> E = { tri[1] - tri[0], tri[2] - tri[0] };
-        mat<2, 2> U = { varying_uv[1] - varying_uv[0], varying_uv[2] - varying_uv[0] };
+    // ߿ռֻйأÿһ
+    virtual void setup(const int face) {
+        const int c[3] = { model.corner(face, 0), model.corner(face, 1), model.corner(face, 2) };
+        const vec2 uv[3] = { get_varying<2>(vertex_varyings(face, 0), varying_uv),
+                             get_varying<2>(vertex_varyings(face, 1), varying_uv),
+                             get_varying<2>(vertex_varyings(face, 2), varying_uv) };
+        const vec4 p[3] = { vec_cast<double>(varying_tri[c[0]]), vec_cast<double>(varying_tri[c[1]]), vec_cast<double>(varying_tri[c[2]]) };
+        mat<2, 4> E = { p[1] - p[0], p[2] - p[0] };
+        mat<2, 2> U = { uv[1] - uv[0], uv[2] - uv[0] };
         mat<2, 4> T = U.invert() * E;
-        mat<4, 4> D = { normalized(T[0]),
-                       normalized(T[1]),
-                       normalized(varying_nrm[0] * bar[0] + varying_nrm[1] * bar[1] + varying_nrm[2] * bar[2]),
+        tangent_basis[face] = { vec_cast<real>(normalized(T[0])), vec_cast<real>(normalized(T[1])) };
+    }
+
+    // ͼ mip ͼϸǵȡ log2СһأŴʱΪ 0
+    double texture_lod(const double* ddx, const double* ddy) const {
+        const double w = model.diffuse().width(), h = model.diffuse().height();
+        const double fx = std::hypot(ddx[varying_uv] * w, ddx[varying_uv + 1] * h);
+        const double fy = std::hypot(ddy[varying_uv] * w, ddy[varying_uv + 1] * h);
+        return std::max(0.0, std::log2(std::max(fx, fy)));
+    }
+
+    // mip αɫ0 ɫΪࡢ̡ơ죬5 ΪƷ
+    static TGAColor lod_color(const double lod) {
+        static constexpr std::uint8_t palette[6][3] = { {255,0,0}, {255,255,0}, {0,255,0}, {0,255,255}, {0,0,255}, {255,0,255} };
+        const int level = std::min(static_cast<int>(lod), 5);
+        return { { palette[level][0], palette[level][1], palette[level][2], 255 } };
+    }
+
+    virtual std::pair<bool, TGAColor> fragment(const int face, const vec3 bar, const double* varying,
+                                               const double* ddx, const double* ddy) const {
+        if (show_lod) return { false, lod_color(texture_lod(ddx, ddy)) };
+
+        // ߿ռ Darboux frame
+        mat<4, 4> D = { vec_cast<double>(tangent_basis[face][0]),
+                       vec_cast<double>(tangent_basis[face][1]),
+                       fast_math ? fast_normalized(get_varying<4>(varying, varying_nrm))
+                                 : normalized(get_varying<4>(varying, varying_nrm)),
                        {0,0,0,1} };
 
-        vec2 uv = varying_uv[0] * bar[0] + varying_uv[1] * bar[1] + varying_uv[2] * bar[2];
-        vec4 n = normalized(D.transpose() * model.normal(uv));
-        vec4 r = normalized(n * (n * l) * 2 - l); // 
+        vec2 uv = get_varying<2>(varying, varying_uv);
+        vec4 n = D.transpose() * model.normal(uv);
+        n = fast_math ? fast_normalized(n) : normalized(n);
+        vec4 r = n * (n * l) * 2 - l; // 
+        r = fast_math ? fast_normalized(r) : normalized(r);
 
         double ambient = 0.4;
         double diffuse = std::max(0.0, n * l);
-        double specular = (3.0 * sample2D(model.specular(), uv)[0] / 255.0) * std::pow(std::max(r.z, 0.0), 35.0);
+        double highlight = fast_math ? specular_pow(r.z) : std::pow(std::max(r.z, 0.0), 35.0);
+        double specular = (3.0 * sample2D(model.specular(), uv)[0] / 255.0) * highlight;
+
+        // Դ䣬ֻӰ쵱ǰĻĹԴ (1 - d/radius)^2 ˥
+        vec3 point = { 0, 0, 0 };
+        const vec3 pos = get_varying<3>(varying, varying_pos);
+        for (int i : tile_lights()) {
+            const PointLight& light = eye_lights()[i];
+            const vec3 d = light.position - pos;
+            const double dist = norm(d);
+            if (dist >= light.radius) continue;
+            const double falloff = 1 - dist / light.radius;
+            point = point + light.color * (falloff * falloff * std::max(0.0, n.xyz() * d / dist));
+        }
 
         TGAColor color = sample2D(model.diffuse(), uv);
-        for (int i = 0; i < 3; i++)
-            color[i] = static_cast<unsigned char>(std::min(255.0, color[i] * (ambient + diffuse + specular)));
+        for (int i = 0; i < 3; i++) // TGAColor  b, g, r 
+            color[i] = static_cast<unsigned char>(std::min(255.0, color[i] * (ambient + diffuse + specular + point[2 - i])));
 
         return { false, color };
     }
+
+    // ƬԪɫ fragment() ͬļ㣬šͨѭֵտԱ
+    // ͼ pow ޷ֻЧͨЧͨмᱻʹ
+    virtual int fragment_packet(const FragmentPacket& packet, TGAColor color[FragmentPacket::LANES]) const {
+        if (show_lod) return detail::fragment_lanes(*this, packet, color);
+        return fast_math ? shade_packet<float>(packet, color) : shade_packet<double>(packet, color);
+    }
+
+    // Ըͨ 4 άλdouble Ϊȷ汾float Ϊ fast_rsqrt Ŀٰ汾
+    template<typename T> static void normalize_lanes(T (&x)[4][FragmentPacket::LANES]) {
+        T len[FragmentPacket::LANES] = {};
+        for (int i = 0; i < 4; i++)
+            for (int k = 0; k < FragmentPacket::LANES; k++) len[k] += x[i][k] * x[i][k];
+        for (int i = 0; i < 4; i++)
+            for (int k = 0; k < FragmentPacket::LANES; k++) {
+                if constexpr (std::is_same_v<T, float>) x[i][k] *= fast_rsqrt(len[k]);
+                else x[i][k] /= std::sqrt(len[k]);
+            }
+    }
+
+    template<typename T> int shade_packet(const FragmentPacket& packet, TGAColor color[FragmentPacket::LANES]) const {
+        constexpr int N = FragmentPacket::LANES;
+        constexpr bool fast = std::is_same_v<T, float>;
+        const mat<2, 4, real>& tb = tangent_basis[packet.face];
+        const double (&u)[N] = packet.varying[varying_uv], (&v)[N] = packet.varying[varying_uv + 1];
+
+        // ֵõķߵλ
+        T nrm[4][N];
+        for (int i = 0; i < 4; i++)
+            for (int k = 0; k < N; k++) nrm[i][k] = static_cast<T>(packet.varying[varying_nrm + i][k]);
+        normalize_lanes(nrm);
+
+        // ͼ Darboux frame תñ任ϵn = T * t.x + B * t.y + N * t.z + (0,0,0,1) * t.w
+        T t[4][N] = {}, n[4][N];
+        for (int k = 0; k < N; k++) {
+            if (!(packet.mask >> k & 1)) continue;
+            const vec4 tn = model.normal(vec2{ u[k], v[k] });
+            for (int i = 0; i < 4; i++) t[i][k] = static_cast<T>(tn[i]);
+        }
+        for (int i = 0; i < 4; i++) {
+            const T tx = static_cast<T>(tb[0][i]), ty = static_cast<T>(tb[1][i]);
+            for (int k = 0; k < N; k++)
+                n[i][k] = tx * t[0][k] + ty * t[1][k] + nrm[i][k] * t[2][k] + (i == 3 ? t[3][k] : T(0));
+        }
+        normalize_lanes(n);
+
+        // 뷴⣺߹ֻҪλ z 
+        const T lv[4] = { static_cast<T>(l.x), static_cast<T>(l.y), static_cast<T>(l.z), static_cast<T>(l.w) };
+        T diffuse[N], highlight[N];
+        for (int k = 0; k < N; k++) {
+            const T nl = n[0][k] * lv[0] + n[1][k] * lv[1] + n[2][k] * lv[2] + n[3][k] * lv[3];
+            T r[4], rr = 0;
+            for (int i = 0; i < 4; i++) {
+                r[i] = n[i][k] * nl * 2 - lv[i];
+                rr += r[i] * r[i];
+            }
+            diffuse[k] = std::max(T(0), nl);
+            if constexpr (fast) highlight[k] = std::max(r[2] * fast_rsqrt(rr), 0.f);
+            else highlight[k] = std::max(r[2] / std::sqrt(rr), 0.0);
+        }
+
+        // Դ䣬ֻӰ쵱ǰĻĹԴ (1 - d/radius)^2 ˥point[c]  r, g, b 
+        T point[3][N] = {};
+        for (int i : tile_lights()) {
+            const PointLight& light = eye_lights()[i];
+            const T radius = static_cast<T>(light.radius);
+            for (int k = 0; k < N; k++) {
+                T d[3], dd = 0;
+                for (int j = 0; j < 3; j++) {
+                    d[j] = static_cast<T>(light.position[j] - packet.varying[varying_pos + j][k]);
+                    dd += d[j] * d[j];
+                }
+                const T inv_dist = fast ? fast_rsqrt(dd) : T(1) / std::sqrt(dd);
+                const T falloff = std::max(T(0), T(1) - dd * inv_dist / radius);
+                const T nd = std::max(T(0), (n[0][k] * d[0] + n[1][k] * d[1] + n[2][k] * d[2]) * inv_dist);
+                for (int j = 0; j < 3; j++) point[j][k] += static_cast<T>(light.color[j]) * (falloff * falloff * nd);
+            }
+        }
+
+        for (int k = 0; k < N; k++) {
+            if (!(packet.mask >> k & 1)) continue;
+            const vec2 uv = { u[k], v[k] };
+            const T specular = fast ? specular_pow(highlight[k]) : std::pow(highlight[k], T(35));
+            const T intensity = T(0.4) + diffuse[k] + (T(3) * sample2D(model.specular(), uv)[0] / T(255)) * specular;
+            color[k] = sample2D(model.diffuse(), uv);
+            for (int i = 0; i < 3; i++) // TGAColor  b, g, r 
+                color[k][i] = static_cast<unsigned char>(std::min(T(255), color[k][i] * (intensity + point[2 - i][k])));
+        }
+        return 0;
+    }
 };
 
+//  n ԴȷֲڳΧ뾶 1.2 ϣ쳲棩ɫɫα仯
+static std::vector<PointLight> make_point_lights(const int n) {
+    constexpr double golden_angle = 2.399963229728653;
+    constexpr double two_pi = 6.283185307179586;
+    std::vector<PointLight> lights;
+    for (int i = 0; i < n; i++) {
+        const double y = 1 - 2 * (i + .5) / n, r = std::sqrt(1 - y * y), phi = golden_angle * i;
+        const double hue = two_pi * i / n;
+        const vec3 color = { .5 + .5 * std::cos(hue), .5 + .5 * std::cos(hue - two_pi / 3), .5 + .5 * std::cos(hue + two_pi / 3) };
+        lights.push_back({ vec3{ r * std::cos(phi), y, r * std::sin(phi) } * 1.2, color * .8, .7 });
+    }
+    return lights;
+}
+
+// ----------------- Уʱ -----------------
+// ϱȽϱʽ det / invert_transpose / invert_affine 밴չİ汾SIMD  4x4 ˷ͨģ塢
+// 𶥵任 transform_streamֱʱκһʱط
+constexpr double MATH_TOLERANCE = 1e-9; // ʽ밴չİ汾֮
+
+template<int n> static mat<n, n> random_matrix(std::mt19937& rng) {
+    std::uniform_real_distribution<double> dist(-1., 1.);
+    mat<n, n> m;
+    do {
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++) m[i][j] = dist(rng);
+    } while (std::abs(det_cofactor(m)) < .05); // ܿӽľֻӳ㷨
+    return m;
+}
+
+template<int n> static double max_diff(const mat<n, n>& a, const mat<n, n>& b) {
+    double ret = 0;
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++) ret = std::max(ret, std::abs(a[i][j] - b[i][j]));
+    return ret;
+}
+
+// ԪزԲοоֵԪ
+template<int n> static double relative_diff(const mat<n, n>& a, const mat<n, n>& reference) {
+    return max_diff(a, reference) / max_diff(reference, mat<n, n>{});
+}
+
+// Ԫ֮ͣʱʱ󶼲
+template<int n> static double sum(const mat<n, n>& m) {
+    double ret = 0;
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < n; j++) ret += m[i][j];
+    return ret;
+}
+
+//  ms еÿ fÿεõظ 9 ȡ죬ٸţۼӵ sinkֹŻ
+template<typename M, typename F> static double time_per_call(const std::vector<M>& ms, const int rounds, F f, double& sink) {
+    double best = HUGE_VAL;
+    for (int repeat = 0; repeat < 9; repeat++) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++)
+            for (const M& m : ms) sink += f(m);
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / (static_cast<double>(rounds) * ms.size()));
+    }
+    return best;
+}
+
+//  det  invert_transpose Ƿ MATH_TOLERANCE 
+template<int n> static bool check_inverse(std::mt19937& rng, const int rounds, double& sink) {
+    std::vector<mat<n, n>> ms;
+    double det_err = 0, inv_err = 0;
+    for (int i = 0; i < 1024; i++) {
+        ms.push_back(random_matrix<n>(rng));
+        const double det = det_cofactor(ms.back());
+        det_err = std::max(det_err, std::abs(ms.back().det() - det) / std::abs(det));
+        inv_err = std::max(inv_err, relative_diff(ms.back().invert_transpose(), invert_transpose_cofactor(ms.back())));
+    }
+    const double det_closed = time_per_call(ms, rounds, [](const mat<n, n>& m) { return m.det(); }, sink);
+    const double det_generic = time_per_call(ms, rounds, [](const mat<n, n>& m) { return det_cofactor(m); }, sink);
+    const double inv_closed = time_per_call(ms, rounds, [](const mat<n, n>& m) { return sum(m.invert_transpose()); }, sink);
+    const double inv_generic = time_per_call(ms, rounds, [](const mat<n, n>& m) { return sum(invert_transpose_cofactor(m)); }, sink);
+    std::cerr << n << "x" << n << ": det " << det_generic << " -> " << det_closed << " ns, invert_transpose "
+              << inv_generic << " -> " << inv_closed << " ns, max relative error det " << det_err << " inverse " << inv_err << std::endl;
+    return det_err <= MATH_TOLERANCE && inv_err <= MATH_TOLERANCE;
+}
+
+static int math_benchmark() {
+    std::mt19937 rng(2024);
+    double sink = 0;
+    bool ok = check_inverse<2>(rng, 200, sink);
+    ok &= check_inverse<3>(rng, 100, sink);
+    ok &= check_inverse<4>(rng, 20, sink);
+
+    //  3x3 ּƽ
+    std::vector<mat<4, 4>> affine;
+    double err = 0;
+    for (int i = 0; i < 1024; i++) {
+        mat<4, 4> m = random_matrix<4>(rng);
+        m[3] = { 0, 0, 0, 1 };
+        if (std::abs(m.det()) < .05) continue;
+        affine.push_back(m);
+        err = std::max(err, relative_diff(invert_affine(m), invert_transpose_cofactor(m).transpose()));
+    }
+    const double closed = time_per_call(affine, 100, [](const mat<4, 4>& m) { return sum(m.invert()); }, sink);
+    const double fast = time_per_call(affine, 100, [](const mat<4, 4>& m) { return sum(invert_affine(m)); }, sink);
+    std::cerr << "4x4 affine: invert " << closed << " ns, invert_affine " << fast << " ns, max relative error " << err << std::endl;
+    ok &= err <= MATH_TOLERANCE;
+
+    // 4x4 ˷geometry.h  SIMD ͨģ壨ʽָģԱȣӦλͬ
+    double product_err = 0;
+    for (const mat<4, 4>& m : affine) {
+        product_err = std::max(product_err, max_diff(m * m.transpose(), operator*<4, 4, 4, double>(m, m.transpose())));
+        for (int i = 0; i < 4; i++) product_err = std::max(product_err, norm(m * m[i] - operator*<4, 4, double>(m, m[i])));
+    }
+    const auto hsum = [](const vec4& v) { return v.x + v.y + v.z + v.w; };
+    const double mv_simd = time_per_call(affine, 200, [&](const mat<4, 4>& m) { return hsum(m * m[1]); }, sink);
+    const double mv_generic = time_per_call(affine, 200, [&](const mat<4, 4>& m) { return hsum(operator*<4, 4, double>(m, m[1])); }, sink);
+    const double mm_simd = time_per_call(affine, 100, [](const mat<4, 4>& m) { return sum(m * m); }, sink);
+    const double mm_generic = time_per_call(affine, 100, [](const mat<4, 4>& m) { return sum(operator*<4, 4, 4, double>(m, m)); }, sink);
+    std::cerr << "4x4 product: mat*vec " << mv_generic << " -> " << mv_simd << " ns, mat*mat " << mm_generic << " -> "
+              << mm_simd << " ns, max difference " << product_err << std::endl;
+    ok &= product_err == 0;
+
+    // 任𶥵 mat * vec4AoS 洢 transform_streamSoA 洢ԱȣӦλͬ
+    const int nstream = 1 << 20;
+    std::uniform_real_distribution<double> coord(-1., 1.);
+    std::vector<vec<4, real>> aos(nstream);
+    std::vector<real> soa[3];
+    for (int i = 0; i < nstream; i++) {
+        aos[i] = vec_cast<real>(vec4{ coord(rng), coord(rng), coord(rng), 1 });
+        for (int j = 0; j < 3; j++) soa[j].push_back(aos[i][j]);
+    }
+    std::vector<vec4> out_aos(nstream);
+    std::vector<double> out_soa[4];
+    for (std::vector<double>& o : out_soa) o.resize(nstream);
+    const std::vector<mat<4, 4>> one = { affine[0] };
+    const double per_vertex = time_per_call(one, 3, [&](const mat<4, 4>& m) {
+        for (int i = 0; i < nstream; i++) out_aos[i] = m * vec_cast<double>(aos[i]);
+        return out_aos[nstream - 1].x;
+    }, sink) / nstream;
+    const double streamed = time_per_call(one, 3, [&](const mat<4, 4>& m) {
+        transform_stream(m, soa[0].data(), soa[1].data(), soa[2].data(), 1., nstream,
+                         out_soa[0].data(), out_soa[1].data(), out_soa[2].data(), out_soa[3].data());
+        return out_soa[0][nstream - 1];
+    }, sink) / nstream;
+    int stream_mismatch = 0;
+    for (int i = 0; i < nstream; i++)
+        for (int j = 0; j < 4; j++) stream_mismatch += out_aos[i][j] != out_soa[j][i];
+    std::cerr << "vertex stream (" << nstream << " vertices): mat*vec " << per_vertex << " -> transform_stream " << streamed
+              << " ns per vertex, " << stream_mismatch << " mismatches" << std::endl;
+    ok &= stream_mismatch == 0;
+    ok &= std::isfinite(sink); // 
+    std::cerr << "math checks " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+// ----------------- ȸʽľУ -----------------
+// ͬСͼرȽϣ RGB һͨͬͨ
+static std::pair<int, int> compare_images(const TGAImage& a, const TGAImage& b) {
+    int differing = 0, max_channel = 0;
+    for (int y = 0; y < a.height(); y++)
+        for (int x = 0; x < a.width(); x++) {
+            const TGAColor ca = a.get(x, y), cb = b.get(x, y);
+            int diff = 0;
+            for (int c = 0; c < 3; c++) diff = std::max(diff, std::abs(ca[c] - cb[c]));
+            differing += diff > 0;
+            max_channel = std::max(max_channel, diff);
+        }
+    return { differing, max_channel };
+}
+
+// ͬһֱ Float64Float32Fixed24 ȻȾ Float64 ͼΪο治ͬͨ
+// ոʽֻӦȼȵοͬ DEPTH_TEST_TOLERANCE ʱط
+constexpr double DEPTH_TEST_TOLERANCE = 1e-4;
+static int depth_precision_test(const std::vector<Model>& scene, std::vector<PhongShader>& shaders, const int width, const int height) {
+    const auto render = [&](const DepthFormat format) {
+        init_zbuffer(width, height, format);
+        TGAImage image(width, height, TGAImage::RGB, { 0,0,0,255 });
+        for (int m = 0; m < static_cast<int>(scene.size()); m++) draw(scene[m], shaders[m], image);
+        return image;
+    };
+    const TGAImage reference = render(DepthFormat::Float64);
+    const std::pair<DepthFormat, const char*> formats[] = { { DepthFormat::Float32, "Float32" }, { DepthFormat::Fixed24, "Fixed24" } };
+    bool ok = true;
+    for (const auto& [format, name] : formats) {
+        const auto [differing, max_channel] = compare_images(reference, render(format));
+        const bool passed = differing <= DEPTH_TEST_TOLERANCE * width * height;
+        std::cerr << name << " vs Float64: " << differing << " / " << width * height << " pixels differ, max channel difference "
+                  << max_channel << (passed ? "" : " (FAILED)") << std::endl;
+        ok &= passed;
+    }
+    return ok ? 0 : 1;
+}
+
+// ----------------- ٹյʱ -----------------
+// ͬһֱþȷ --fastmath Ŀ·floatfast_rsqrtSpecularTableȾ
+// 治ͬͨߵȾʱȾ 5 ȡ죩
+// ·ֻ뼶ͨ FAST_MATH_TOLERANCE ʱط
+constexpr int FAST_MATH_TOLERANCE = 2;
+static int fast_math_accuracy_test(const std::vector<Model>& scene, std::vector<PhongShader>& shaders, const int width,
+                                   const int height, const DepthFormat format) {
+    const auto render = [&](const bool fast, double& best) {
+        for (PhongShader& shader : shaders) shader.fast_math = fast;
+        init_zbuffer(width, height, format);
+        TGAImage image(width, height, TGAImage::RGB, { 0,0,0,255 });
+        const auto start = std::chrono::steady_clock::now();
+        for (int m = 0; m < static_cast<int>(scene.size()); m++) draw(scene[m], shaders[m], image);
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+        return image;
+    };
+    double exact_ms = HUGE_VAL, fast_ms = HUGE_VAL;
+    TGAImage exact, fast;
+    for (int repeat = 0; repeat < 5; repeat++) {
+        exact = render(false, exact_ms);
+        fast = render(true, fast_ms);
+    }
+    const auto [differing, max_channel] = compare_images(exact, fast);
+    const bool passed = max_channel <= FAST_MATH_TOLERANCE;
+    std::cerr << "fast math vs exact: " << differing << " / " << width * height << " pixels differ, max channel difference "
+              << max_channel << (passed ? "" : " (FAILED)") << ", render " << exact_ms << " -> " << fast_ms << " ms" << std::endl;
+    return passed ? 0 : 1;
+}
+
+// ӡһ߼
+static void print_stats(const std::string& label, const PipelineStats& s) {
+    std::cerr << label << ": " << s.triangles << " triangles (" << s.culled << " culled, " << s.clipped << " clipped), "
+              << s.bbox_pixels << " bbox pixels (" << s.hiz_rejected << " skipped by hi-z), " << s.covered << " covered, "
+              << s.depth_failed << " depth failed, " << s.shaded << " shaded, " << s.discarded << " discarded, "
+              << s.writes << " writes" << std::endl;
+}
+
 // ----------------- main -----------------
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " obj/model.obj" << std::endl;
+    //  -- ͷĲΪѡΪģļ
+    std::vector<std::string> models;
+    bool prepass = false, visibility = false, dynamic_dispatch = false, fast_math = false, stats = false, show_lod = false;
+    bool depth_test = false, fast_math_test = false;
+    int nlights = 0;
+    DepthFormat depth_format = DepthFormat::Float64;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--mathbench") return math_benchmark(); // У鲢ʱ붥任Ⱦ
+        if (arg == "--scalar") set_raster_path(RasterPath::Scalar); // ر SIMD ǲԣڶԱ
+        else if (arg == "--prepass") prepass = true;               // ȾȣֻΪɼƬԪɫ
+        else if (arg == "--visibility") visibility = true;         // ɼԻ壺ȹդΪÿɼɫһ
+        else if (arg == "--depth32") depth_format = DepthFormat::Float32; // 32 λ㷴 Z Ȼ
+        else if (arg == "--depth24") depth_format = DepthFormat::Fixed24; // 24 λȻ
+        else if (arg == "--depthtest") depth_test = true;          // ȸʽȾ Float64 ͼĲ죬ͼ
+        else if (arg == "--virtual") dynamic_dispatch = true;      //  IShader 麯ƬԪɫģ汾ԱȺʱ
+        else if (arg == "--fastmath") fast_math = true;            // ʹ floatƽ߹ұ
+        else if (arg == "--fastmathtest") fast_math_test = true; // ֱþȷٹȾͼʱͼ
+        else if (arg == "--lights" && i + 1 < argc) nlights = std::stoi(argv[++i]); //  n ɫԴ
+        else if (arg == "--lod") show_lod = true;                  // αɫʾĻռ䵼ͼ mip 
+        else if (arg == "--stats") stats = true;                   // ӡȾʱÿλ֡Ĺ߼
+        else if (arg == "--threads" && i + 1 < argc) {             // ָȾ߳߳޹
+            const int threads = std::stoi(argv[++i]);
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#else
+            if (threads != 1) std::cerr << "built without OpenMP, --threads ignored" << std::endl;
+#endif
+        }
+        else models.push_back(arg);
+    }
+    if (models.empty()) {
+        std::cerr << "Usage: " << argv[0] << " --mathbench | [--scalar] [--prepass|--visibility] [--depth32|--depth24|--depthtest] [--virtual] [--fastmath|--fastmathtest] [--lod] [--lights n] [--stats] [--threads n] obj/model.obj ..." << std::endl;
         return 1;
     }
 
@@ -67,21 +485,96 @@ int main(int argc, char** argv) {
     constexpr vec3 center{ 0,0,0 };
     constexpr vec3     up{ 0,1,0 };
 
-    lookat(eye, center, up);
-    init_perspective(norm(eye - center));
-    init_viewport(width / 16, height / 16, width * 7 / 8, height * 7 / 8);
-    init_zbuffer(width, height);
+    // ̶ڱ
+    constexpr mat<4, 4> modelview = lookat_matrix(eye, center, up);
+    constexpr mat<4, 4> perspective = perspective_matrix(norm(eye - center));
+    constexpr mat<4, 4> viewport = viewport_matrix(width / 16, height / 16, width * 7 / 8, height * 7 / 8);
+    static_assert(norm((modelview * vec4{ eye.x, eye.y, eye.z, 1 }).xyz() - vec3{ 0, 0, norm(eye - center) }) < 1e-12,
+                  "lookat must put the eye on the +z axis");
+    render_state.set_modelview(modelview);
+    render_state.set_perspective(perspective);
+    render_state.set_viewport(viewport);
+    init_zbuffer(width, height, depth_format);
+
+    set_point_lights(make_point_lights(nlights), width, height);
 
     // ɫ framebuffer
     TGAImage framebuffer(width, height, TGAImage::RGB, { 0,0,0,255 });
 
-    for (int m = 1; m < argc; m++) {
-        Model model(argv[m]);
-        PhongShader shader(light, model);
-        for (int f = 0; f < model.nfaces(); f++) {
-            Triangle clip = { shader.vertex(f,0), shader.vertex(f,1), shader.vertex(f,2) };
-            rasterize(clip, shader, framebuffer);
+    // ȫģͣԤȾɼԻ嶼Ҫ
+    std::vector<Model> scene;
+    std::vector<PhongShader> shaders;
+    scene.reserve(models.size());
+    shaders.reserve(models.size());
+    for (const std::string& filename : models) {
+        PhongShader& shader = shaders.emplace_back(light, scene.emplace_back(filename));
+        shader.fast_math = fast_math;
+        shader.show_lod = shader.derivatives = show_lod;
+    }
+
+    if (depth_test) return depth_precision_test(scene, shaders, width, height);
+    if (fast_math_test) return fast_math_accuracy_test(scene, shaders, width, height, depth_format);
+
+    // Ĭϰɫʵդ--virtual ʱת IShader 
+    // ÿλƵļȴȾʱٴӡ
+    std::vector<std::pair<std::string, PipelineStats>> draws;
+    const auto draw_model = [&](const int m) {
+        long long passed = dynamic_dispatch ? draw(scene[m], static_cast<IShader&>(shaders[m]), framebuffer)
+                                            : draw(scene[m], shaders[m], framebuffer);
+        if (stats) draws.push_back({ models[m], draw_stats() });
+        return passed;
+    };
+    const auto rasterize_model = [&](const std::vector<Triangle>& clip, const int m) {
+        long long passed = dynamic_dispatch ? rasterize(clip, static_cast<const IShader&>(shaders[m]), framebuffer)
+                                            : rasterize(clip, shaders[m], framebuffer);
+        if (stats) draws.push_back({ models[m], draw_stats() });
+        return passed;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    if (visibility) {
+        set_raster_mode(RasterMode::Visibility);
+        long long visible = 0;
+        for (int m = 0; m < static_cast<int>(scene.size()); m++)
+            visible += draw_model(m);
+        long long shaded = resolve_visibility(framebuffer);
+        std::cerr << "visibility buffer: shaded " << shaded << " of " << visible << " depth-passing fragments" << std::endl;
+        set_raster_mode(RasterMode::Normal);
+    } else if (prepass) {
+        // ׶ֻһΣդòüռ
+        std::vector<std::vector<Triangle>> clip;
+        for (int m = 0; m < static_cast<int>(scene.size()); m++)
+            clip.push_back(vertex_stage(scene[m], shaders[m]));
+
+        // һ飺ֻдȣ²ԤȾʱÿģͻɫƬԪ
+        std::vector<long long> depth_passed(scene.size());
+        set_raster_mode(RasterMode::DepthOnly);
+        for (int m = 0; m < static_cast<int>(scene.size()); m++)
+            depth_passed[m] = rasterize_model(clip[m], m);
+
+        // ڶ飺ֻΪտɼƬԪɫ
+        set_raster_mode(RasterMode::DepthEqual);
+        for (int m = 0; m < static_cast<int>(scene.size()); m++) {
+            long long shaded = rasterize_model(clip[m], m);
+            std::cerr << models[m] << ": shaded " << shaded << " of " << depth_passed[m]
+                      << " fragments, overdraw avoided " << depth_passed[m] - shaded << std::endl;
         }
+        set_raster_mode(RasterMode::Normal);
+    } else {
+        for (int m = 0; m < static_cast<int>(scene.size()); m++)
+            draw_model(m);
+    }
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (stats) {
+        std::cerr << "render: " << elapsed.count() << " ms (" << (dynamic_dispatch ? "virtual" : "static")
+                  << " fragment dispatch, " << (std::is_same_v<real, float> ? "float" : "double") << " storage)" << std::endl;
+        for (const auto& [label, s] : draws) print_stats(label, s);
+        print_stats("frame", frame_stats());
+        const VertexDedupStats dedup = vertex_dedup_stats();
+        std::cerr << "vertex dedup: " << dedup.corners << " triangle corners, " << dedup.vertex_calls << " unique vertices shaded, "
+                  << dedup.corners - dedup.vertex_calls << " vertex() calls saved ("
+                  << 100. * (dedup.corners - dedup.vertex_calls) / std::max(dedup.corners, 1LL) << "%)" << std::endl;
     }
 
     framebuffer.flip_vertically();
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <map>
+#include <tuple>
 
 Model::Model(const std::string filename) {
     std::ifstream in(filename);
@@ -25,21 +27,22 @@ Model::Model(const std::string filename) {
             iss >> trash;
             vec4 v{ 0,0,0,1 };
             for (int i : {0, 1, 2}) iss >> v[i];
-            verts.push_back(v);
+            for (int i : {0, 1, 2}) verts[i].push_back(static_cast<real>(v[i]));
         }
         // 
         else if (!line.compare(0, 3, "vn ")) {
             iss >> trash >> trash;
             vec4 n{ 0,0,0,0 };
             for (int i : {0, 1, 2}) iss >> n[i];
-            norms.push_back(normalized(n));
+            n = normalized(n);
+            for (int i : {0, 1, 2}) norms[i].push_back(static_cast<real>(n[i]));
         }
         // 
         else if (!line.compare(0, 3, "vt ")) {
             iss >> trash >> trash;
             vec2 uv{ 0,0 };
             for (int i : {0, 1}) iss >> uv[i];
-            tex.push_back({ uv.x, 1 - uv.y }); // ת Y
+            tex.push_back(vec_cast<real>(vec2{ uv.x, 1 - uv.y })); // ת Y
         }
         // 
         else if (!line.compare(0, 2, "f ")) {
@@ -58,7 +61,15 @@ Model::Model(const std::string filename) {
         }
     }
 
-    std::cerr << "# vertices: " << nverts() << " # faces: " << nfaces() << std::endl;
+    // Ϊÿͬ (v, vt, vn) ϷΨһ
+    std::map<std::tuple<int, int, int>, int> corner_ids;
+    for (int i = 0; i < static_cast<int>(facet_vrt.size()); i++) {
+        auto [it, inserted] = corner_ids.try_emplace({ facet_vrt[i], facet_tex[i], facet_nrm[i] }, ncorners());
+        if (inserted) corner_sources.push_back(i);
+        facet_corner.push_back(it->second);
+    }
+
+    std::cerr << "# vertices: " << nverts() << " # faces: " << nfaces() << " # corners: " << ncorners() << std::endl;
 
     // ----------------------------
     // ȫͼ
@@ -76,12 +87,21 @@ Model::Model(const std::string filename) {
     load_texture("_spec.tga", specularmap);
 }
 
-int Model::nverts() const { return verts.size(); }
+int Model::nverts() const { return verts[0].size(); }
+int Model::nnormals() const { return norms[0].size(); }
 int Model::nfaces() const { return facet_vrt.size() / 3; }
+int Model::ncorners() const { return corner_sources.size(); }
 
-vec4 Model::vert(const int i) const { return verts[i]; }
-vec4 Model::vert(const int iface, const int nthvert) const { return verts[facet_vrt[iface * 3 + nthvert]]; }
-vec4 Model::normal(const int iface, const int nthvert) const { return norms[facet_nrm[iface * 3 + nthvert]]; }
+vec4 Model::vert(const int i) const { return { verts[0][i], verts[1][i], verts[2][i], 1 }; }
+vec4 Model::vert(const int iface, const int nthvert) const { return vert(vert_index(iface, nthvert)); }
+int Model::vert_index(const int iface, const int nthvert) const { return facet_vrt[iface * 3 + nthvert]; }
+vec4 Model::normal(const int iface, const int nthvert) const {
+    const int i = normal_index(iface, nthvert);
+    return { norms[0][i], norms[1][i], norms[2][i], 0 };
+}
+int Model::normal_index(const int iface, const int nthvert) const { return facet_nrm[iface * 3 + nthvert]; }
+const real* Model::vert_stream(const int axis) const { return verts[axis].data(); }
+const real* Model::normal_stream(const int axis) const { return norms[axis].data(); }
 
 vec4 Model::normal(const vec2& uv) const {
     int x = std::min(std::max(int(uv[0] * normalmap.width()), 0), normalmap.width() - 1);
@@ -90,6 +110,9 @@ vec4 Model::normal(const vec2& uv) const {
     return normalized(vec4{ (double)c[2],(double)c[1],(double)c[0],0 }*2. / 255. - vec4{ 1,1,1,0 });
 }
 
-vec2 Model::uv(const int iface, const int nthvert) const { return tex[facet_tex[iface * 3 + nthvert]]; }
+int Model::corner(const int iface, const int nthvert) const { return facet_corner[iface * 3 + nthvert]; }
+int Model::corner_source(const int corner) const { return corner_sources[corner]; }
+
+vec2 Model::uv(const int iface, const int nthvert) const { return vec_cast<double>(tex[facet_tex[iface * 3 + nthvert]]); }
 const TGAImage& Model::diffuse()  const { return diffusemap; }
 const TGAImage& Model::specular() const { return specularmap; }
@@ -3,20 +3,25 @@
 #include "tgaimage.h"
 
 class Model {
-    //  (v)
-    std::vector<vec4> verts = {};
+    //  real ȴ洢ʱתΪ double
+    //  (v)x/y/z ֿţSoAw Ϊ 1
+    std::vector<real> verts[3] = {};
 
-    // 㷨 (vn)
-    std::vector<vec4> norms = {};
+    // 㷨 (vn)x/y/z ֿţSoAw Ϊ 0
+    std::vector<real> norms[3] = {};
 
     //  (vt)
-    std::vector<vec2> tex = {};
+    std::vector<vec<2, real>> tex = {};
 
     // 㡢ߡ
     std::vector<int> facet_vrt = {}; // ÿεĶ (3 * nfaces)
     std::vector<int> facet_nrm = {}; // ÿεķ (3 * nfaces)
     std::vector<int> facet_tex = {}; // ÿε (3 * nfaces)
 
+    // Ψһ㣺ͬ (v, vt, vn) ϸռһţ任㻺渴
+    std::vector<int> facet_corner = {}; // ÿζΨһ (3 * nfaces)
+    std::vector<int> corner_sources = {}; // ÿΨһһγֵλ iface * 3 + nthvert
+
     // ͼ
     TGAImage diffusemap = {};  // ͼ
     TGAImage normalmap = {};  // ͼ
@@ -28,15 +33,27 @@ public:
 
     // ģͳ
     int nverts() const; // 
+    int nnormals() const; // 
     int nfaces() const; // 
+    int ncorners() const; // Ψһ (v, vt, vn) 
 
     // 
     vec4 vert(const int i) const;                        // ص i 
     vec4 vert(const int iface, const int nthvert) const; // ص iface εĵ nthvert 
+    int vert_index(const int iface, const int nthvert) const; //  iface ε nthvert ڶе±
 
     // ߷
     vec4 normal(const int iface, const int nthvert) const; //  .obj ļ vn ȡ
     vec4 normal(const vec2& uv) const;                     //  normal map ͼȡ
+    int normal_index(const int iface, const int nthvert) const; //  iface ε nthvert ڷе±
+
+    //  axis 0/1/2 Ϊ x/y/z飬Ϊ nverts() / nnormals() transform_stream 任
+    const real* vert_stream(const int axis) const;
+    const real* normal_stream(const int axis) const;
+
+    // Ψһ
+    int corner(const int iface, const int nthvert) const; //  iface ε nthvert Ψһ
+    int corner_source(const int corner) const;             // Ψһһγֵλ iface * 3 + nthvert
 
     // 
     vec2 uv(const int iface, const int nthvert) const;
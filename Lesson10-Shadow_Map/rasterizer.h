@@ -0,0 +1,459 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "MyGL.h"
+
+// ģ rasterize<Shader> ʵ֣صĴҪɫ֪ĵطʵԷͷļ
+// ״̬뺯ֻդڲʹã MyGL.cpp ά
+
+extern std::vector<double> zbuffer;
+
+namespace detail {
+
+extern DepthFormat depth_format;
+extern std::vector<float> zbuffer32;         // Float32 ʽȴ洢
+extern std::vector<std::uint32_t> zbuffer24; // Fixed24 ʽȴ洢 24 λЧ
+constexpr double FIXED24_MAX = (1 << 24) - 1;
+
+// βü͸Ӿ w ڵ۵ľ f
+constexpr double NEAR_W = .1;                // ƽ w = 0.1۵ľΪ 0.1f
+
+constexpr int TILE_SIZE = 64;              // դĻ߳أ
+
+// ֲ Z-bufferÿ 8x8 ؿ¼ȵСֵԶȣ
+// ڿڵȲʱ鶼ͨȲ
+constexpr int HIZ_BLOCK = 8;               // Hi-Z ߳TILE_SIZE 
+static_assert(TILE_SIZE % HIZ_BLOCK == 0);
+extern std::vector<double> hiz;
+extern int hiz_width;                      // ÿе Hi-Z 
+
+extern RasterPath raster_path;             // ǰʹõĸǲʵ
+extern RasterMode raster_mode;             // ǰȲ/ɫģʽ
+
+// ɼԻ壺ÿظ 32 λΪƱţ 32 λΪڸûƽе
+// Ų int ķΧҲܴﵽ 2^32 - 1ԱŲƣҲ VIS_EMPTY ͬ
+constexpr std::uint64_t VIS_EMPTY = ~0ull;
+constexpr int VIS_TRIANGLE_BITS = 32;
+extern std::vector<std::uint64_t> visbuffer;
+extern std::uint64_t vis_draw;             // ǰ rasterize õĻƱ
+
+// ------------------- ȴ洢 -------------------
+//  NDC.z ɵǰʽڱȽϵֵԽԽܱǰʽȷ
+inline double depth_key(const double z) {
+    if (depth_format == DepthFormat::Float64) return z;
+    //  Z1 + z/f ǡõ 1/w f 뵽۵֮ȣԽԽԶΪ 0
+    const double d = 1. - z * render_state.perspective()[3][2];
+    if (depth_format == DepthFormat::Float32) return static_cast<float>(d);
+    // ʽҪн磺Խƽ w 󣬽ƽ洦Ϊ 1
+    return std::round(std::clamp(d * NEAR_W, 0., 1.) * FIXED24_MAX);
+}
+
+inline double depth_read(const int idx) {
+    switch (depth_format) {
+    case DepthFormat::Float32: return zbuffer32[idx];
+    case DepthFormat::Fixed24: return zbuffer24[idx];
+    default:                   return zbuffer[idx];
+    }
+}
+
+inline void depth_write(const int idx, const double key) {
+    switch (depth_format) {
+    case DepthFormat::Float32: zbuffer32[idx] = static_cast<float>(key); break;
+    case DepthFormat::Fixed24: zbuffer24[idx] = static_cast<std::uint32_t>(key); break;
+    default:                   zbuffer[idx] = key; break;
+    }
+}
+
+// ǰģʽµȲԣDepthEqual ֻԤȾȫͬƬԪ
+inline bool depth_test(const double z, const double stored) {
+    return raster_mode == RasterMode::DepthEqual ? z == stored : z > stored;
+}
+
+// DepthEqual ɫдȱǣ֮ͬƬԪͨ뵥Ⱦһȵʤ
+// ʽΪԶʽȡ 24 λΧֵ֮κ depth_key 
+inline double depth_consumed() {
+    return depth_format == DepthFormat::Fixed24 ? static_cast<double>(~std::uint32_t(0)) : -HUGE_VAL;
+}
+
+// ------------------- ν -------------------
+// ÿֻһεĹ͸ӳӿڱ任޳Χ
+struct TriangleSetup {
+    int face;                 // е±
+    vec3 invw;                // üռ w ĵ͸
+    const real* varyings[3];  // ԭθ varying ָɫĴ洢
+    vec3 bc_dx, bc_dy, bc_0;  // ߺ = bc_dx * x + bc_dy * y + bc_0
+    double z_dx, z_dy, z_0;   // ƽ棺z = z_dx * x + z_dy * y + z_0
+    int bbminx, bbmaxx, bbminy, bbmaxy; // üĻڵİΧ
+    bool clipped;             // ǷΪü
+    mat<3, 3> bar;            // ζԭε꣨Уclipped ʱЧ
+};
+
+// ɼԻģʽ±ÿλƵɫν resolve_visibility ʹ
+struct VisibilityDraw {
+    const IShader* shader;
+    std::vector<TriangleSetup> tris;
+};
+extern std::vector<VisibilityDraw> vis_draws;
+
+// Դķֿ޳ÿĻӰĹԴ±
+// դ resolve_visibility ڴһĻǰб󶨵ǰ̣߳ tile_lights() 
+extern std::vector<std::vector<int>> light_tiles;
+extern thread_local const std::vector<int>* bound_lights;
+void bind_tile_lights(const int tile);
+
+// һβü뽨׷ӵ trisȫڽƽֱ֮Ӷ
+void clip_and_setup(const Triangle& clip, const int face, const int width, const int height, const IShader& shader,
+                    std::vector<TriangleSetup>& tris, PipelineStats& stats);
+
+// һ rasterize ý
+void record_draw_stats(const PipelineStats& stats);
+
+// ------------------- ͸ -------------------
+// Ļ굽üռ꣺Ļ갴 1/w Ȩһÿֻһγ
+inline vec3 perspective_bc(const TriangleSetup& tri, const vec3& bc_screen) {
+    const vec3 bc_w = { bc_screen.x * tri.invw.x, bc_screen.y * tri.invw.y, bc_screen.z * tri.invw.z };
+    const vec3 bc_clip = bc_w * (1. / (bc_w.x + bc_w.y + bc_w.z));
+    return tri.clipped ? bc_clip * tri.bar : bc_clip; // λԭε
+}
+
+// varying ڲüռԣԭεֵķ
+inline void interpolate_varyings(const TriangleSetup& tri, const vec3& bar, const int n, double* varying) {
+    for (int j = 0; j < n; j++)
+        varying[j] = tri.varyings[0][j] * bar.x + tri.varyings[1][j] * bar.y + tri.varyings[2][j] * bar.z;
+}
+
+// ------------------- Ļռ䵼 -------------------
+// ȵڵ 2x2 ؿ飨ϽΪżϡص varying ֮
+//  SIMD ·ƬԪ ddx/ddy ͬزڣߺ
+inline void quad_derivatives(const TriangleSetup& tri, const int x, const int y, const int n, double* ddx, double* ddy) {
+    const vec3 bc = tri.bc_dx * (x & ~1) + tri.bc_dy * (y & ~1) + tri.bc_0;
+    double v0[MAX_VARYINGS], v1[MAX_VARYINGS], v2[MAX_VARYINGS];
+    interpolate_varyings(tri, perspective_bc(tri, bc), n, v0);
+    interpolate_varyings(tri, perspective_bc(tri, bc + tri.bc_dx), n, v1);
+    interpolate_varyings(tri, perspective_bc(tri, bc + tri.bc_dy), n, v2);
+    for (int j = 0; j < n; j++) {
+        ddx[j] = v1[j] - v0[j];
+        ddy[j] = v2[j] - v0[j];
+    }
+}
+
+// ------------------- ƬԪɫ -------------------
+// IShader ֻܾ麯ãɫ޶ãȷĿ꣬
+template<typename Shader>
+std::pair<bool, TGAColor> fragment(const Shader& shader, const int face, const vec3& bar, const double* varying,
+                                   const double* ddx, const double* ddy) {
+    if constexpr (std::is_same_v<Shader, IShader>) return shader.fragment(face, bar, varying, ddx, ddy);
+    else return shader.Shader::fragment(face, bar, varying, ddx, ddy);
+}
+
+// ƬԪĬʵ֣Чͨ fragment()ԾɫͬȷĿ
+template<typename Shader> int fragment_lanes(const Shader& shader, const FragmentPacket& packet, TGAColor color[FragmentPacket::LANES]) {
+    int discard = 0;
+    for (int k = 0; k < FragmentPacket::LANES; k++) {
+        if (!(packet.mask >> k & 1)) continue;
+        double varying[MAX_VARYINGS];
+        for (int j = 0; j < shader.nvaryings; j++) varying[j] = packet.varying[j][k];
+        bool d;
+        std::tie(d, color[k]) = fragment(shader, packet.face, { packet.bar[0][k], packet.bar[1][k], packet.bar[2][k] }, varying,
+                                         shader.derivatives ? packet.ddx : nullptr, shader.derivatives ? packet.ddy : nullptr);
+        discard |= d << k;
+    }
+    return discard;
+}
+
+// ɫд fragment_packet ʱԼİ汾 fragment_lanes麯
+template<typename Shader> int fragment_packet(const Shader& shader, const FragmentPacket& packet, TGAColor color[FragmentPacket::LANES]) {
+    if constexpr (std::is_same_v<Shader, IShader>) return shader.fragment_packet(packet, color);
+    else if constexpr (std::is_same_v<decltype(&Shader::fragment_packet), decltype(&IShader::fragment_packet)>)
+        return fragment_lanes(shader, packet, color);
+    else return shader.Shader::fragment_packet(packet, color);
+}
+
+// ------------------- صɫд -------------------
+// ǰͨǲȲԣǷд zbuffer
+template<typename Shader>
+bool shade_pixel(const TriangleSetup& tri, const int x, const int y, const vec3& bc_screen, const double z,
+                 const Shader& shader, TGAImage& framebuffer, PipelineStats& stats) {
+    if (raster_mode == RasterMode::DepthOnly) { // ֻдȣƬԪɫ
+        depth_write(x + y * framebuffer.width(), depth_key(z));
+        return true;
+    }
+    if (raster_mode == RasterMode::Visibility) { // ֻдȺαţɫ resolve_visibility
+        const std::uint64_t index = static_cast<std::uint64_t>(&tri - vis_draws[vis_draw].tris.data());
+        depth_write(x + y * framebuffer.width(), depth_key(z));
+        visbuffer[x + y * framebuffer.width()] = (vis_draw << VIS_TRIANGLE_BITS) | index;
+        return true;
+    }
+
+    // ƬԪɫȡɫ
+    const vec3 bar = perspective_bc(tri, bc_screen);
+    double varying[MAX_VARYINGS], ddx[MAX_VARYINGS], ddy[MAX_VARYINGS];
+    interpolate_varyings(tri, bar, shader.nvaryings, varying);
+    if (shader.derivatives) quad_derivatives(tri, x, y, shader.nvaryings, ddx, ddy);
+    auto [discard, color] = fragment(shader, tri.face, bar, varying, shader.derivatives ? ddx : nullptr,
+                                     shader.derivatives ? ddy : nullptr);
+    stats.shaded++;
+    if (discard) { // ɫ
+        stats.discarded++;
+        return false;
+    }
+
+    //  Z-buffer ֡壬DepthEqual ģʽѾֵֻǸɫ
+    framebuffer.set(x, y, color);
+    stats.writes++;
+    if (raster_mode == RasterMode::DepthEqual) {
+        depth_write(x + y * framebuffer.width(), depth_consumed());
+        return false;
+    }
+    depth_write(x + y * framebuffer.width(), depth_key(z));
+    return true;
+}
+
+#if defined(MYGL_SIMD_AVX) || defined(MYGL_SIMD_SSE2)
+// 2x2 ؿе k ͨصƫƣ(k & 1, k >> 1)
+constexpr int quad_dx(const int k) { return k & 1; }
+constexpr int quad_dy(const int k) { return k >> 1; }
+
+// ------------------- ƬԪɫд -------------------
+//  (x, y) ΪϽǵ 2x2 ؿ mask ڵͨǲȲԣһƬԪɫ
+// Ƿд zbuffer mask ڵͨͬߺƲֵ
+template<typename Shader>
+bool shade_packet(const TriangleSetup& tri, const int x, const int y, const int mask, const vec3& bc_screen, const double z,
+                  const Shader& shader, TGAImage& framebuffer, PipelineStats& stats) {
+    static_assert(FragmentPacket::LANES == 4);
+    FragmentPacket packet = { tri.face, x, y, mask };
+    for (int k = 0; k < FragmentPacket::LANES; k++) {
+        const vec3 bar = perspective_bc(tri, bc_screen + tri.bc_dx * quad_dx(k) + tri.bc_dy * quad_dy(k));
+        for (int i : {0, 1, 2}) packet.bar[i][k] = bar[i];
+        for (int j = 0; j < shader.nvaryings; j++)
+            packet.varying[j][k] = tri.varyings[0][j] * bar.x + tri.varyings[1][j] * bar.y + tri.varyings[2][j] * bar.z;
+    }
+    for (int j = 0; j < shader.nvaryings; j++) {
+        packet.ddx[j] = packet.varying[j][1] - packet.varying[j][0];
+        packet.ddy[j] = packet.varying[j][2] - packet.varying[j][0];
+    }
+
+    TGAColor color[FragmentPacket::LANES];
+    const int shaded = mask & ~fragment_packet(shader, packet, color);
+    stats.shaded += std::popcount(static_cast<unsigned>(mask));
+    stats.discarded += std::popcount(static_cast<unsigned>(mask & ~shaded));
+    stats.writes += std::popcount(static_cast<unsigned>(shaded));
+    for (int k = 0; k < FragmentPacket::LANES; k++) {
+        if (!(shaded >> k & 1)) continue;
+        const int px = x + quad_dx(k), py = y + quad_dy(k);
+        framebuffer.set(px, py, color[k]);
+        depth_write(px + py * framebuffer.width(), raster_mode == RasterMode::DepthEqual ? depth_consumed()
+                                                   : depth_key(z + tri.z_dx * quad_dx(k) + tri.z_dy * quad_dy(k)));
+    }
+    return raster_mode != RasterMode::DepthEqual && shaded;
+}
+
+// ------------------- SIMD ǲ -------------------
+// һβ (x, y) ΪϽǵ 2x2 ؿ飺ߺȲԣͨ룬inside Ϊֻߺĸ
+// Сȡ 2x2  8 أ4x2ֱͨ FragmentPacketddx/ddy ǿڵĲ֣
+// ߺȶ double 㣬һ AVX Ĵ 4 ͨ8 ֻĴ float ֻ·һ
+// idx ΪȻе±꣬valid Ϊڹդ룬زȡ
+inline int coverage_mask4(const TriangleSetup& tri, const vec3& bc, const double z, const int idx, const int width,
+                          const int valid, int& inside) {
+    alignas(32) double zb[4], zk[4];
+    for (int k = 0; k < 4; k++) zb[k] = valid >> k & 1 ? depth_read(idx + quad_dx(k) + quad_dy(k) * width) : HUGE_VAL;
+    //  Float64 ʽȰÿص洢ʽٱȽϣص depth_key λͬ
+    // Fixed24 ͨ depth_keyFloat32  SIMD ָ double -> float -> double ת
+    // ͨ static_cast<float>  GCC 12 -mavx2 »ᱻ SLP Ȳ float 
+    const bool fixed = depth_format == DepthFormat::Fixed24, to_float = depth_format == DepthFormat::Float32;
+    if (fixed)
+        for (int k = 0; k < 4; k++) zk[k] = depth_key(z + tri.z_dx * quad_dx(k) + tri.z_dy * quad_dy(k));
+    const double reverse = render_state.perspective()[3][2];
+    const bool equal = raster_mode == RasterMode::DepthEqual;
+#if defined(MYGL_SIMD_AVX)
+    const __m256d lx = _mm256_set_pd(1, 0, 1, 0), ly = _mm256_set_pd(1, 1, 0, 0);
+    const __m256d zero = _mm256_setzero_pd();
+    const auto plane = [&](const double c, const double dx, const double dy) {
+        return _mm256_add_pd(_mm256_add_pd(_mm256_set1_pd(c), _mm256_mul_pd(_mm256_set1_pd(dx), lx)),
+                             _mm256_mul_pd(_mm256_set1_pd(dy), ly));
+    };
+    const auto to_key = [&](const __m256d v) {
+        return _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_sub_pd(_mm256_set1_pd(1.), _mm256_mul_pd(v, _mm256_set1_pd(reverse)))));
+    };
+    const __m256d vz = fixed ? _mm256_load_pd(zk) : to_float ? to_key(plane(z, tri.z_dx, tri.z_dy)) : plane(z, tri.z_dx, tri.z_dy);
+    const __m256d depth = equal ? _mm256_cmp_pd(vz, _mm256_load_pd(zb), _CMP_EQ_OQ)
+                                : _mm256_cmp_pd(vz, _mm256_load_pd(zb), _CMP_GT_OQ);
+    __m256d edge = _mm256_cmp_pd(plane(bc[0], tri.bc_dx[0], tri.bc_dy[0]), zero, _CMP_GE_OQ);
+    for (int i : {1, 2})
+        edge = _mm256_and_pd(edge, _mm256_cmp_pd(plane(bc[i], tri.bc_dx[i], tri.bc_dy[i]), zero, _CMP_GE_OQ));
+    inside = _mm256_movemask_pd(edge) & valid;
+    return _mm256_movemask_pd(_mm256_and_pd(edge, depth)) & valid;
+#else
+    // Ͱ벿Ϊһеأ߰벿Ϊһе
+    const __m128d lx = _mm_set_pd(1, 0);
+    const __m128d zero = _mm_setzero_pd();
+    const auto plane = [&](const double c, const double dx, const double dy, const double row) {
+        return _mm_add_pd(_mm_add_pd(_mm_set1_pd(c), _mm_mul_pd(_mm_set1_pd(dx), lx)), _mm_set1_pd(dy * row));
+    };
+    const auto to_key = [&](const __m128d v) {
+        return _mm_cvtps_pd(_mm_cvtpd_ps(_mm_sub_pd(_mm_set1_pd(1.), _mm_mul_pd(v, _mm_set1_pd(reverse)))));
+    };
+    const __m128d vz_lo = fixed ? _mm_load_pd(zk) : to_float ? to_key(plane(z, tri.z_dx, tri.z_dy, 0)) : plane(z, tri.z_dx, tri.z_dy, 0);
+    const __m128d vz_hi = fixed ? _mm_load_pd(zk + 2) : to_float ? to_key(plane(z, tri.z_dx, tri.z_dy, 1)) : plane(z, tri.z_dx, tri.z_dy, 1);
+    const __m128d depth_lo = equal ? _mm_cmpeq_pd(vz_lo, _mm_load_pd(zb)) : _mm_cmpgt_pd(vz_lo, _mm_load_pd(zb));
+    const __m128d depth_hi = equal ? _mm_cmpeq_pd(vz_hi, _mm_load_pd(zb + 2)) : _mm_cmpgt_pd(vz_hi, _mm_load_pd(zb + 2));
+    __m128d edge_lo = _mm_castsi128_pd(_mm_set1_epi32(-1)), edge_hi = edge_lo;
+    for (int i : {0, 1, 2}) {
+        edge_lo = _mm_and_pd(edge_lo, _mm_cmpge_pd(plane(bc[i], tri.bc_dx[i], tri.bc_dy[i], 0), zero));
+        edge_hi = _mm_and_pd(edge_hi, _mm_cmpge_pd(plane(bc[i], tri.bc_dx[i], tri.bc_dy[i], 1), zero));
+    }
+    inside = (_mm_movemask_pd(edge_lo) | (_mm_movemask_pd(edge_hi) << 2)) & valid;
+    return (_mm_movemask_pd(_mm_and_pd(edge_lo, depth_lo)) | (_mm_movemask_pd(_mm_and_pd(edge_hi, depth_hi)) << 2)) & valid;
+#endif
+}
+#endif
+
+// ------------------- ڵĹդ -------------------
+// Ƿд zbuffer׶εļۼӵ stats
+template<typename Shader>
+bool rasterize_rect(const TriangleSetup& tri, const int xmin, const int ymin, const int xmax, const int ymax,
+                    const Shader& shader, TGAImage& framebuffer, PipelineStats& stats) {
+    const int width = framebuffer.width();
+    bool written = false;
+    stats.bbox_pixels += static_cast<long long>(xmax - xmin + 1) * (ymax - ymin + 1);
+
+#if defined(MYGL_SIMD_AVX) || defined(MYGL_SIMD_SSE2)
+    if (raster_path == RasterPath::SIMD) {
+        // ϽΪż 2x2 ؿÿβ 4 أͨشһƬԪɫ
+        // ھزҲд룬ֻΪĸ
+        const vec3 bc_dx2 = tri.bc_dx * 2.;
+        const double z_dx2 = tri.z_dx * 2.;
+        const bool packets = raster_mode == RasterMode::Normal || raster_mode == RasterMode::DepthEqual;
+        for (int y = ymin & ~1; y <= ymax; y += 2) {
+            const int rows = (y >= ymin ? 0b0011 : 0) | (y + 1 <= ymax ? 0b1100 : 0);
+            vec3 bc_screen = tri.bc_dx * (xmin & ~1) + tri.bc_dy * y + tri.bc_0;
+            double z = tri.z_dx * (xmin & ~1) + tri.z_dy * y + tri.z_0;
+            for (int x = xmin & ~1; x <= xmax; x += 2, bc_screen = bc_screen + bc_dx2, z += z_dx2) {
+                const int valid = rows & ((x >= xmin ? 0b0101 : 0) | (x + 1 <= xmax ? 0b1010 : 0));
+                int inside;
+                int mask = coverage_mask4(tri, bc_screen, z, x + y * width, width, valid, inside);
+                stats.covered += std::popcount(static_cast<unsigned>(inside));
+                stats.depth_failed += std::popcount(static_cast<unsigned>(inside & ~mask));
+                if (mask && packets) {
+                    written |= shade_packet(tri, x, y, mask, bc_screen, z, shader, framebuffer, stats);
+                    continue;
+                }
+                for (; mask; mask &= mask - 1) { // ֻдȵģʽش
+                    const int k = std::countr_zero(static_cast<unsigned>(mask));
+                    written |= shade_pixel(tri, x + quad_dx(k), y + quad_dy(k), bc_screen + tri.bc_dx * quad_dx(k) + tri.bc_dy * quad_dy(k),
+                                           z + tri.z_dx * quad_dx(k) + tri.z_dy * quad_dy(k), shader, framebuffer, stats);
+                }
+            }
+        }
+        return written;
+    }
+#endif
+
+    // бֵһΣ
+    for (int y = ymin; y <= ymax; y++) {
+        vec3 bc_screen = tri.bc_dx * xmin + tri.bc_dy * y + tri.bc_0;
+        double z = tri.z_dx * xmin + tri.z_dy * y + tri.z_0;
+
+        for (int x = xmin; x <= xmax; x++, bc_screen = bc_screen + tri.bc_dx, z += tri.z_dx) {
+            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue; // 
+            stats.covered++;
+            if (!depth_test(depth_key(z), depth_read(x + y * width))) { // Ȳ
+                stats.depth_failed++;
+                continue;
+            }
+            written |= shade_pixel(tri, x, y, bc_screen, z, shader, framebuffer, stats);
+        }
+    }
+    return written;
+}
+
+// ------------------- ĻڵĹդ -------------------
+//  Hi-Z ΰΧĻĽȫڵ Hi-Z 
+template<typename Shader>
+void rasterize_tile(const TriangleSetup& tri, const int x0, const int y0, const int x1, const int y1,
+                    const Shader& shader, TGAImage& framebuffer, PipelineStats& stats) {
+    const int xmin = std::max(tri.bbminx, x0), xmax = std::min(tri.bbmaxx, x1);
+    const int ymin = std::max(tri.bbminy, y0), ymax = std::min(tri.bbmaxy, y1);
+    const int width = framebuffer.width(), height = framebuffer.height();
+
+    for (int by = ymin / HIZ_BLOCK; by <= ymax / HIZ_BLOCK; by++) {
+        for (int bx = xmin / HIZ_BLOCK; bx <= xmax / HIZ_BLOCK; bx++) {
+            const int rx0 = std::max(xmin, bx * HIZ_BLOCK), rx1 = std::min(xmax, bx * HIZ_BLOCK + HIZ_BLOCK - 1);
+            const int ry0 = std::max(ymin, by * HIZ_BLOCK), ry1 = std::min(ymax, by * HIZ_BLOCK + HIZ_BLOCK - 1);
+
+            // Ļռƽ棬ھڵȡĳǵ
+            const double znear = depth_key(tri.z_0 + tri.z_dx * (tri.z_dx > 0 ? rx1 : rx0) + tri.z_dy * (tri.z_dy > 0 ? ry1 : ry0));
+            double& zfar = hiz[bx + by * hiz_width];
+            // DepthEqual ²޳ǵز벻ͬ޴ͻδɫĿն
+            if (raster_mode != RasterMode::DepthEqual && znear <= zfar) { // 鱻ڵ
+                stats.hiz_rejected += static_cast<long long>(rx1 - rx0 + 1) * (ry1 - ry0 + 1);
+                continue;
+            }
+
+            if (!rasterize_rect(tri, rx0, ry0, rx1, ry1, shader, framebuffer, stats)) continue;
+
+            // д룬ÿԶ
+            zfar = HUGE_VAL;
+            for (int y = by * HIZ_BLOCK; y < std::min((by + 1) * HIZ_BLOCK, height); y++)
+                for (int x = bx * HIZ_BLOCK; x < std::min((bx + 1) * HIZ_BLOCK, width); x++)
+                    zfar = std::min(zfar, depth_read(x + y * width));
+        }
+    }
+}
+
+} // namespace detail
+
+// ------------------- դ -------------------
+template<typename Shader> long long rasterize(const std::vector<Triangle>& clip, const Shader& shader, TGAImage& framebuffer) {
+    static_assert(std::is_base_of_v<IShader, Shader>, "Shader must derive from IShader");
+    using namespace detail;
+    const int width = framebuffer.width(), height = framebuffer.height();
+    const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    // νÿֻһ
+    // ɼԻģʽ½Ҫ resolve_visibilityֱӷŽб
+    if (raster_mode == RasterMode::Visibility) {
+        if (visbuffer.empty()) visbuffer = std::vector(width * height, VIS_EMPTY);
+        vis_draw = vis_draws.size();
+        vis_draws.push_back({ &shader, {} });
+    }
+    std::vector<TriangleSetup> local_tris;
+    std::vector<TriangleSetup>& tris = raster_mode == RasterMode::Visibility ? vis_draws.back().tris : local_tris;
+    PipelineStats stats;
+    stats.triangles = static_cast<long long>(clip.size());
+    tris.reserve(clip.size());
+    for (int f = 0; f < static_cast<int>(clip.size()); f++)
+        clip_and_setup(clip[f], f, width, height, shader, tris, stats);
+
+    // 䣺ύ˳ηΧиǵÿĻ
+    std::vector<std::vector<int>> bins(tiles_x * tiles_y);
+    for (int t = 0; t < static_cast<int>(tris.size()); t++)
+        for (int ty = tris[t].bbminy / TILE_SIZE; ty <= tris[t].bbmaxy / TILE_SIZE; ty++)
+            for (int tx = tris[t].bbminx / TILE_SIZE; tx <= tris[t].bbmaxx / TILE_SIZE; tx++)
+                bins[tx + ty * tiles_x].push_back(t);
+
+    // ÿ̶߳ռĻ飬Ȳд뻥Ҳֿٻ
+    std::vector<PipelineStats> tile_stats(tiles_x * tiles_y);
+#pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < tiles_x * tiles_y; tile++) {
+        const int x0 = (tile % tiles_x) * TILE_SIZE, y0 = (tile / tiles_x) * TILE_SIZE;
+        const int x1 = std::min(x0 + TILE_SIZE, width) - 1, y1 = std::min(y0 + TILE_SIZE, height) - 1;
+        bind_tile_lights(tile);
+        for (int t : bins[tile])
+            rasterize_tile(tris[t], x0, y0, x1, y1, shader, framebuffer, tile_stats[tile]);
+    }
+    for (const PipelineStats& s : tile_stats) stats += s;
+    record_draw_stats(stats);
+    return stats.covered - stats.depth_failed;
+}
+
+// -------------------  -------------------
+template<typename Shader> long long draw(const Model& model, Shader& shader, TGAImage& framebuffer) {
+    return rasterize(vertex_stage(model, shader), shader, framebuffer);
+}